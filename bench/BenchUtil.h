@@ -0,0 +1,275 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/// A minimal Google-Benchmark-style harness: registered benchmarks are run for each argument set,
+/// timed in batches so that per-batch setup is excluded, and reported as a table or as Google Benchmark JSON.
+
+namespace bench {
+
+struct BenchArgs {
+    int depth          = 1; // price levels per side
+    int ordersPerLevel = 1;
+};
+
+/// PerfCounters reads hardware counters of this thread with perf_event_open (Linux only), user space only.
+/// Counters are opened as one group so that they are enabled & disabled together with one ioctl.
+/// Counters the CPU or VM doesn't support are skipped.
+class PerfCounters {
+public:
+    static constexpr int NumCounters                 = 5;
+    static constexpr const char *Names[NumCounters] = {"cycles", "instructions", "L1D-misses", "LLC-misses", "branch-misses"};
+
+private:
+    int      _fds[NumCounters];
+    uint64_t _values[NumCounters]{};
+
+public:
+    PerfCounters() { std::fill(std::begin(_fds), std::end(_fds), -1); }
+    ~PerfCounters() { close(); }
+    PerfCounters(const PerfCounters &)            = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    /// @return false if the group leader (cycles) can't be opened, e.g. no PMU in a VM or perf_event_paranoid > 2.
+    bool open() {
+#ifdef __linux__
+        const std::pair<uint32_t, uint64_t> events[NumCounters] = {
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+                {PERF_TYPE_HW_CACHE,
+                 PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES}, // LLC misses
+                {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        };
+        for (int i = 0; i < NumCounters; ++i) {
+            perf_event_attr attr{};
+            attr.size           = sizeof(attr);
+            attr.type           = events[i].first;
+            attr.config         = events[i].second;
+            attr.disabled       = i == 0; // members follow the leader.
+            attr.exclude_kernel = 1;
+            attr.exclude_hv     = 1;
+            _fds[i]             = int(syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : _fds[0], 0));
+            if (_fds[0] < 0) {
+                std::cerr << "WARNING: perf counters unavailable: " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            if (_fds[i] < 0) std::cerr << "WARNING: perf counter " << Names[i] << " unavailable: " << std::strerror(errno) << std::endl;
+        }
+        return true;
+#else
+        std::cerr << "WARNING: perf counters are only supported on Linux." << std::endl;
+        return false;
+#endif
+    }
+    void close() {
+#ifdef __linux__
+        for (int &fd : _fds) {
+            if (fd >= 0) ::close(fd);
+            fd = -1;
+        }
+#endif
+    }
+    bool isOpen() const { return _fds[0] >= 0; }
+    bool hasCounter(int i) const { return _fds[i] >= 0; }
+
+    void reset() {
+#ifdef __linux__
+        if (isOpen()) ioctl(_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+    void enable() {
+#ifdef __linux__
+        if (isOpen()) ioctl(_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+    void disable() {
+#ifdef __linux__
+        if (isOpen()) ioctl(_fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+    /// @return counts since reset.
+    const uint64_t *read() {
+#ifdef __linux__
+        for (int i = 0; i < NumCounters; ++i) {
+            if (_fds[i] < 0 || ::read(_fds[i], &_values[i], sizeof(uint64_t)) != ssize_t(sizeof(uint64_t))) _values[i] = 0;
+        }
+#endif
+        return _values;
+    }
+};
+
+class BenchState {
+    using Clock = std::chrono::steady_clock;
+
+    double            _minTimeSec;
+    Clock::time_point _wallStart = Clock::now(), _batchStart;
+    uint64_t          _nanos{}, _ops{}, _batches{};
+    PerfCounters     *_perf;
+
+public:
+    const BenchArgs args;
+
+    BenchState(const BenchArgs &args, double minTimeSec, PerfCounters *perf = nullptr) : _minTimeSec(minTimeSec), _perf(perf), args(args) {
+        if (_perf) _perf->reset();
+    }
+
+    /// @return true if more batches are needed. Runs at least one batch and gives up after 10x minTime of wall time.
+    bool keepRunning() const {
+        if (_batches == 0) return true;
+        double wall = std::chrono::duration<double>(Clock::now() - _wallStart).count();
+        return _nanos < _minTimeSec * 1e9 && wall < 10 * _minTimeSec;
+    }
+
+    /// time a batch of operations. Code outside startBatch/stopBatch is setup and isn't timed.
+    void startBatch() {
+        if (_perf) _perf->enable();
+        _batchStart = Clock::now();
+    }
+    void stopBatch(uint64_t nOps) {
+        _nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - _batchStart).count();
+        if (_perf) _perf->disable();
+        _ops += nOps;
+        ++_batches;
+    }
+
+    uint64_t ops() const { return _ops; }
+    double   nanosPerOp() const { return _ops ? double(_nanos) / _ops : 0; }
+};
+
+struct BenchResult {
+    std::string         name;
+    uint64_t            ops;
+    double              nanosPerOp;
+    std::vector<double> countersPerOp; // PerfCounters::Names order, negative if unavailable; empty without --perf.
+};
+
+using BenchFunc = std::function<void(BenchState &)>;
+
+struct Registry {
+    std::vector<std::pair<std::string, BenchFunc>> benchmarks;
+
+    static Registry &instance() {
+        static Registry registry;
+        return registry;
+    }
+};
+
+inline bool registerBench(const std::string &name, BenchFunc func) {
+    Registry::instance().benchmarks.emplace_back(name, std::move(func));
+    return true;
+}
+
+#define BENCHMARK(func) static const bool _bench_registered_##func = bench::registerBench(#func, func)
+
+inline std::vector<int> parseIntList(const std::string &s) {
+    std::vector<int> res;
+    for (size_t pos = 0; pos < s.size();) {
+        size_t end = std::min(s.find(',', pos), s.size());
+        res.push_back(std::stoi(s.substr(pos, end - pos)));
+        pos = end + 1;
+    }
+    return res;
+}
+
+inline void writeJson(std::ostream &os, const std::vector<BenchResult> &results) {
+    os << "{\n  \"context\": {\n    \"library_build_type\": \""
+#ifdef NDEBUG
+       << "release"
+#else
+       << "debug"
+#endif
+       << "\"\n  },\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult &r = results[i];
+        os << "    {\n      \"name\": \"" << r.name << "\",\n      \"run_type\": \"iteration\",\n      \"iterations\": " << r.ops
+           << ",\n      \"real_time\": " << r.nanosPerOp << ",\n      \"cpu_time\": " << r.nanosPerOp << ",\n      \"time_unit\": \"ns\"";
+        for (size_t k = 0; k < r.countersPerOp.size(); ++k) // user counters
+            if (r.countersPerOp[k] >= 0) os << ",\n      \"" << PerfCounters::Names[k] << "\": " << r.countersPerOp[k];
+        os << "\n    }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    os << "  ]\n}\n";
+}
+
+/// Run registered benchmarks for each depth x ordersPerLevel.
+/// Options: --filter substring, --depth 1,10,100, --opl 1,10, --min-time seconds, --json outputFile, --perf (hardware counters per op)
+inline int runBenchmarks(int argc, char *argv[]) {
+    std::string      filter, jsonPath;
+    std::vector<int> depths = {1, 10, 100, 1000}, ordersPerLevels = {1, 10, 100};
+    double           minTimeSec = 0.1;
+    PerfCounters     perf;
+    bool             usePerf = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--perf") {
+            usePerf = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--filter substring] [--depth 1,10,100,1000] [--opl 1,10,100] [--min-time 0.1] [--json file] [--perf]" << std::endl;
+            return 1;
+        }
+        if (arg == "--filter") filter = argv[++i];
+        else if (arg == "--depth") depths = parseIntList(argv[++i]);
+        else if (arg == "--opl") ordersPerLevels = parseIntList(argv[++i]);
+        else if (arg == "--min-time") minTimeSec = std::strtod(argv[++i], nullptr);
+        else if (arg == "--json") jsonPath = argv[++i];
+    }
+
+    usePerf = usePerf && perf.open();
+
+    std::vector<BenchResult> results;
+    std::printf("%-60s %14s %12s", "Benchmark", "ns/op", "ops");
+    if (usePerf)
+        for (const char *name : PerfCounters::Names) std::printf(" %14s", name);
+    std::printf("\n");
+    for (auto &[name, func] : Registry::instance().benchmarks) {
+        for (int depth : depths) {
+            for (int opl : ordersPerLevels) {
+                std::string fullName = name + "/depth:" + std::to_string(depth) + "/ordersPerLevel:" + std::to_string(opl);
+                if (!filter.empty() && fullName.find(filter) == std::string::npos) continue;
+                BenchState state(BenchArgs{.depth = depth, .ordersPerLevel = opl}, minTimeSec, usePerf ? &perf : nullptr);
+                func(state);
+                results.push_back(BenchResult{.name = fullName, .ops = state.ops(), .nanosPerOp = state.nanosPerOp()});
+                std::printf("%-60s %14.1f %12llu", fullName.c_str(), state.nanosPerOp(), (unsigned long long)state.ops());
+                if (usePerf) {
+                    const uint64_t *counts = perf.read();
+                    for (int k = 0; k < PerfCounters::NumCounters; ++k) {
+                        double perOp = perf.hasCounter(k) && state.ops() ? double(counts[k]) / state.ops() : -1;
+                        results.back().countersPerOp.push_back(perOp);
+                        if (perOp < 0) std::printf(" %14s", "n/a");
+                        else std::printf(" %14.2f", perOp);
+                    }
+                }
+                std::printf("\n");
+                std::fflush(stdout);
+            }
+        }
+    }
+    if (!jsonPath.empty()) {
+        std::ofstream file(jsonPath);
+        writeJson(file, results);
+        if (!file) {
+            std::cerr << "ERROR: failed to write " << jsonPath << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+} // namespace bench
@@ -0,0 +1,140 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include "OrderBook.h"
+#include "RequestParser.h"
+#include "SimpleTradeReporter.h"
+#include "TscClock.h"
+#include "OrderFlowGenerator.h"
+
+/// End-to-end benchmark of the SimpleMatchingEngineMain pipeline in-process: CSV lines are parsed, matched and
+/// the events are formatted to the CSV output format. Each stage of each message is timed with TscClock.
+/// Events are captured during matching and formatted afterwards by SimpleTradeReporter so that stages don't overlap.
+
+namespace {
+/// CaptureReporter keeps the events of the current request for the format stage.
+struct CaptureReporter {
+    std::vector<TradeMsg> trades;
+    struct Error {
+        OrderID orderID;
+        MsgType msgType;
+        ErrCode errCode;
+    };
+    std::vector<Error> errors;
+
+    void onTrade(const TradeMsg &msg) { trades.push_back(msg); }
+    void onError(OrderID orderID, MsgType msgType, ErrCode errCode, const std::string &) { errors.push_back(Error{orderID, msgType, errCode}); }
+};
+static_assert(BookEventReporter<CaptureReporter>, "CaptureReporter Impl BookEventReporter");
+
+enum Stage { Parse, Match, Format, Total, NumStages };
+const char *StageNames[NumStages] = {"parse", "match", "format", "total"};
+
+void printPercentiles(const char *name, std::vector<uint32_t> &ticks, uint64_t totalTicks) {
+    if (ticks.empty()) return;
+    auto percentile = [&](double p) {
+        size_t k = std::min(ticks.size() - 1, size_t(p * ticks.size()));
+        std::nth_element(ticks.begin(), ticks.begin() + k, ticks.end());
+        return TscClock::toNanos(ticks[k]);
+    };
+    double p50 = percentile(0.5), p99 = percentile(0.99), p999 = percentile(0.999);
+    double max = TscClock::toNanos(*std::max_element(ticks.begin(), ticks.end()));
+    double mean = TscClock::toNanos(totalTicks) / ticks.size(), totalSec = TscClock::toNanos(totalTicks) / 1e9;
+    std::printf("%-8s %10.1f %10.1f %10.1f %10.1f %12.1f %12.3f\n", name, p50, p99, p999, max, mean, totalSec);
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+    uint64_t    nRequests = 1000000, seed = 1;
+    std::string inputPath, outputPath;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-n" && i + 1 < argc) {
+            nRequests = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "-s" && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "-f" && i + 1 < argc) {
+            inputPath = argv[++i];
+        } else if (arg == "-o" && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [-n nRequests] [-s seed] [-f inputCSV] [-o outputFile]\n"
+                      << "  Generates nRequests with OrderFlowGenerator unless an input CSV is given." << std::endl;
+            return 1;
+        }
+    }
+
+    //-- prepare the input in memory.
+    std::string input;
+    if (!inputPath.empty()) {
+        std::ifstream     file(inputPath);
+        std::stringstream ss;
+        EXPECT_OR_ERR(file, return 1, "ERROR: failed to open " << inputPath);
+        ss << file.rdbuf();
+        input = ss.str();
+    } else {
+        OrderFlowGenerator gen(OrderFlowConfig{.seed = seed});
+        std::stringstream  ss;
+        for (uint64_t i = 0; i < nRequests; ++i) formatRequestCSV(ss, gen.next());
+        input = ss.str();
+    }
+    nRequests = std::count(input.begin(), input.end(), '\n');
+    std::cerr << "Input: " << nRequests << " requests, " << input.size() << " bytes. TSC ticks/ns: " << TscClock::ticksPerNano() << std::endl;
+
+    //-- run the pipeline.
+    CaptureReporter            stageReporter;
+    OrderBook<CaptureReporter> book{stageReporter};
+    std::ostringstream         output, errOutput;
+    SimpleTradeReporter        formatter{output, errOutput};
+    std::vector<uint32_t>      ticks[NumStages];
+    uint64_t                   totalTicks[NumStages]{};
+    uint64_t                   outputBytes = 0;
+    std::ofstream              outputFile;
+    if (!outputPath.empty()) outputFile.open(outputPath);
+    for (auto &v : ticks) v.reserve(nRequests);
+
+    std::istringstream istrm(input);
+    auto               wallStart = std::chrono::steady_clock::now();
+    uint64_t           t0        = TscClock::now();
+    StrUtil::read_each_str(istrm, '\n', [&](int iLine, std::string &line) {
+        OrderRequest req;
+        bool         ok = parseRequestLine(iLine, line, req);
+        uint64_t     t1 = TscClock::now();
+        if (ok) book.handleRequest(req);
+        uint64_t t2 = TscClock::now();
+        for (const TradeMsg &msg : stageReporter.trades) formatter.onTrade(msg);
+        for (const auto &err : stageReporter.errors) formatter.onError(err.orderID, err.msgType, err.errCode, "");
+        stageReporter.trades.clear();
+        stageReporter.errors.clear();
+        if (output.tellp() > (1 << 20)) { // drain the output buffer
+            std::string s = output.str();
+            outputBytes += s.size();
+            if (outputFile.is_open()) outputFile << s;
+            output.str("");
+        }
+        uint64_t t3 = TscClock::now();
+
+        uint64_t stageTicks[NumStages] = {t1 - t0, t2 - t1, t3 - t2, t3 - t0};
+        for (int i = 0; i < NumStages; ++i) {
+            ticks[i].push_back(uint32_t(std::min<uint64_t>(stageTicks[i], UINT32_MAX)));
+            totalTicks[i] += stageTicks[i];
+        }
+        t0 = t3; // reading the next line is accounted to parse.
+    });
+    double wallSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    outputBytes += output.str().size();
+    if (outputFile.is_open()) outputFile << output.str();
+
+    std::printf("messages: %llu, wall seconds: %.3f, messages/sec: %.0f, output bytes: %llu\n",
+                (unsigned long long)ticks[Total].size(),
+                wallSec,
+                ticks[Total].size() / wallSec,
+                (unsigned long long)outputBytes);
+    std::printf("%-8s %10s %10s %10s %10s %12s %12s\n", "stage", "p50(ns)", "p99(ns)", "p99.9(ns)", "max(ns)", "mean(ns)", "total(s)");
+    for (int i = 0; i < NumStages; ++i) printPercentiles(StageNames[i], ticks[i], totalTicks[i]);
+    return 0;
+}
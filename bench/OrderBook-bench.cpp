@@ -0,0 +1,211 @@
+#include <random>
+#include <unordered_map>
+#include <numeric>
+
+#include "BenchUtil.h"
+#include "OrderBook.h"
+
+/// Microbenchmarks of OrderBook operations on a book with `depth` levels per side and `ordersPerLevel` orders per level.
+/// Each batch of operations is timed; the book is restored to its initial shape between batches, untimed.
+
+using bench::BenchState;
+
+namespace {
+constexpr CentPrice MidPrice  = 100000;
+constexpr Qty       OrderQty  = 100;
+constexpr size_t    BatchSize = 256;
+
+struct BenchReporter {
+    std::vector<OrderID> filledRestingOrders;
+    uint64_t             nErrors{};
+
+    void onTrade(const TradeMsg &msg) {
+        if (msg.restingOrderFill.isFull) filledRestingOrders.push_back(msg.restingOrderFill.orderID);
+    }
+    void onError(OrderID, MsgType, ErrCode, const std::string &) { ++nErrors; }
+};
+static_assert(BookEventReporter<BenchReporter>, "BenchReporter Impl BookEventReporter");
+
+/// BookFixture builds a book with orders of OrderQty on both sides and restores removed orders.
+struct BookFixture {
+    struct Slot {
+        OrderID   orderID;
+        Side      side;
+        CentPrice price;
+    };
+
+    BenchReporter                       reporter;
+    OrderBook<BenchReporter>            book{reporter};
+    std::vector<Slot>                   slots; // in priority order for each side: buy side, then sell side.
+    std::unordered_map<OrderID, size_t> slotByOrderID;
+    OrderID                             nextOrderID = 1;
+    std::mt19937_64                     rng{42};
+    const int                           depth, ordersPerLevel;
+
+    explicit BookFixture(const bench::BenchArgs &args) : depth(args.depth), ordersPerLevel(args.ordersPerLevel) {
+        for (Side side : {Side::Buy, Side::Sell}) {
+            for (int i = 0; i < depth; ++i) {
+                for (int j = 0; j < ordersPerLevel; ++j) {
+                    slots.push_back(Slot{.orderID = 0, .side = side, .price = levelPrice(side, i)});
+                    addSlot(slots.size() - 1);
+                }
+            }
+        }
+    }
+
+    static CentPrice levelPrice(Side side, int level) { return side == Side::Buy ? MidPrice - 1 - level : MidPrice + 1 + level; }
+    size_t           ordersPerSide() const { return size_t(depth) * ordersPerLevel; }
+
+    void addSlot(size_t iSlot) {
+        Slot &slot                  = slots[iSlot];
+        slot.orderID                = nextOrderID++;
+        slotByOrderID[slot.orderID] = iSlot;
+        book.matchAddNewOrder(slot.orderID, slot.side, OrderQty, slot.price);
+    }
+
+    /// re-add the removed orders with new orderIDs.
+    void restore(const std::vector<OrderID> &removedOrders) {
+        for (OrderID orderID : removedOrders) {
+            auto it = slotByOrderID.find(orderID);
+            if (it == slotByOrderID.end()) continue;
+            size_t iSlot = it->second;
+            slotByOrderID.erase(it);
+            addSlot(iSlot);
+        }
+    }
+    void restoreFilled() {
+        restore(reporter.filledRestingOrders);
+        reporter.filledRestingOrders.clear();
+    }
+
+    /// pick n distinct slots in [begin, end).
+    std::vector<size_t> pickSlots(size_t begin, size_t end, size_t n) {
+        std::vector<size_t> picked(end - begin);
+        std::iota(picked.begin(), picked.end(), begin);
+        n = std::min(n, picked.size());
+        for (size_t i = 0; i < n; ++i) std::swap(picked[i], picked[i + rng() % (picked.size() - i)]);
+        picked.resize(n);
+        return picked;
+    }
+};
+
+void AddPassive(BenchState &state) {
+    BookFixture fixture(state.args);
+    while (state.keepRunning()) {
+        std::vector<std::pair<Side, CentPrice>> orders;
+        for (size_t i = 0; i < BatchSize; ++i) {
+            Side side = i % 2 ? Side::Sell : Side::Buy;
+            orders.emplace_back(side, BookFixture::levelPrice(side, int(fixture.rng() % fixture.depth)));
+        }
+        OrderID firstID = fixture.nextOrderID;
+        state.startBatch();
+        for (auto [side, price] : orders) fixture.book.matchAddNewOrder(fixture.nextOrderID++, side, OrderQty, price);
+        state.stopBatch(orders.size());
+        for (OrderID id = firstID; id < fixture.nextOrderID; ++id) fixture.book.cancelOrder(id);
+    }
+}
+BENCHMARK(AddPassive);
+
+/// each aggressive sell fully fills exactly one resting buy order.
+void AddAggressiveSingleFill(BenchState &state) {
+    BookFixture fixture(state.args);
+    size_t      n = std::min(BatchSize, fixture.ordersPerSide());
+    while (state.keepRunning()) {
+        state.startBatch();
+        for (size_t i = 0; i < n; ++i) fixture.book.matchAddNewOrder(fixture.nextOrderID++, Side::Sell, OrderQty, MidPrice - fixture.depth);
+        state.stopBatch(n);
+        fixture.restoreFilled();
+    }
+}
+BENCHMARK(AddAggressiveSingleFill);
+
+/// one aggressive sell sweeps all buy levels.
+void DeepSweep(BenchState &state) {
+    BookFixture fixture(state.args);
+    while (state.keepRunning()) {
+        state.startBatch();
+        fixture.book.matchAddNewOrder(fixture.nextOrderID++, Side::Sell, Qty(OrderQty * fixture.ordersPerSide()), MidPrice - fixture.depth);
+        state.stopBatch(1);
+        fixture.restoreFilled();
+    }
+}
+BENCHMARK(DeepSweep);
+
+/// cancel orders from the top of the buy side in priority order. Whole levels are cancelled so that priority order is kept after restore.
+void CancelTop(BenchState &state) {
+    BookFixture          fixture(state.args);
+    size_t               n = std::min(std::max<size_t>(BatchSize / fixture.ordersPerLevel, 1) * fixture.ordersPerLevel, fixture.ordersPerSide());
+    std::vector<OrderID> orderIDs;
+    while (state.keepRunning()) {
+        orderIDs.clear();
+        for (size_t i = 0; i < n; ++i) orderIDs.push_back(fixture.slots[i].orderID);
+        state.startBatch();
+        for (OrderID orderID : orderIDs) fixture.book.cancelOrder(orderID);
+        state.stopBatch(n);
+        fixture.restore(orderIDs);
+    }
+}
+BENCHMARK(CancelTop);
+
+/// cancel random orders behind the top level of the buy side.
+void CancelMidBook(BenchState &state) {
+    BookFixture fixture(state.args);
+    if (fixture.depth < 2) return;
+    std::vector<OrderID> orderIDs;
+    while (state.keepRunning()) {
+        orderIDs.clear();
+        for (size_t iSlot : fixture.pickSlots(fixture.ordersPerLevel, fixture.ordersPerSide(), BatchSize))
+            orderIDs.push_back(fixture.slots[iSlot].orderID);
+        state.startBatch();
+        for (OrderID orderID : orderIDs) fixture.book.cancelOrder(orderID);
+        state.stopBatch(orderIDs.size());
+        fixture.restore(orderIDs);
+    }
+}
+BENCHMARK(CancelMidBook);
+
+void PartialCancel(BenchState &state) {
+    BookFixture          fixture(state.args);
+    std::vector<OrderID> orderIDs;
+    while (state.keepRunning()) {
+        orderIDs.clear();
+        for (size_t iSlot : fixture.pickSlots(0, fixture.slots.size(), BatchSize)) orderIDs.push_back(fixture.slots[iSlot].orderID);
+        state.startBatch();
+        for (OrderID orderID : orderIDs) fixture.book.partialCancelOrder(orderID, 1);
+        state.stopBatch(orderIDs.size());
+        for (OrderID orderID : orderIDs) fixture.book.amendOrder(orderID, OrderQty, fixture.slots[fixture.slotByOrderID[orderID]].price);
+    }
+}
+BENCHMARK(PartialCancel);
+
+/// replace random orders with a new orderID at another level of the same side.
+void Replace(BenchState &state) {
+    BookFixture fixture(state.args);
+    struct Replacement {
+        size_t    iSlot;
+        OrderID   newOrderID;
+        CentPrice newPrice;
+    };
+    std::vector<Replacement> replacements;
+    while (state.keepRunning()) {
+        replacements.clear();
+        for (size_t iSlot : fixture.pickSlots(0, fixture.slots.size(), BatchSize)) {
+            Side side = fixture.slots[iSlot].side;
+            replacements.push_back(Replacement{iSlot, fixture.nextOrderID++, BookFixture::levelPrice(side, int(fixture.rng() % fixture.depth))});
+        }
+        state.startBatch();
+        for (auto &r : replacements) fixture.book.replaceOrder(fixture.slots[r.iSlot].orderID, r.newOrderID, OrderQty, r.newPrice);
+        state.stopBatch(replacements.size());
+        // move orders back to their slot's price.
+        for (auto &r : replacements) {
+            BookFixture::Slot &slot = fixture.slots[r.iSlot];
+            fixture.slotByOrderID.erase(slot.orderID);
+            fixture.book.cancelOrder(r.newOrderID);
+            fixture.addSlot(r.iSlot);
+        }
+    }
+}
+BENCHMARK(Replace);
+} // namespace
+
+int main(int argc, char *argv[]) { return bench::runBenchmarks(argc, argv); }
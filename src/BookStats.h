@@ -0,0 +1,20 @@
+#pragma once
+#include <iostream>
+
+#include "OrderBook.h"
+
+/// Write BookStats as a single-line JSON object.
+inline void writeStatsJson(std::ostream &os, const BookStats &stats, uint64_t nRequests) {
+    os << "{\"requests\":" << nRequests << ",\"orderIDs\":" << stats.nOrderIDs << ",\"orderIDBuckets\":" << stats.nOrderIDBuckets
+       << ",\"orderIDLoadFactor\":" << stats.orderIDLoadFactor << ",\"orderIDMeanProbeLength\":" << stats.orderIDMeanProbeLength
+       << ",\"orderIDMaxProbeLength\":" << stats.orderIDMaxProbeLength;
+    static const char *sideNames[2] = {"buy", "sell"};
+    for (int i = 0; i < 2; ++i) {
+        const SideBookStats &side = stats.sides[i];
+        os << ",\"" << sideNames[i] << "\":{\"adds\":" << side.nAdds << ",\"cancels\":" << side.nCancels << ",\"fills\":" << side.nFills
+           << ",\"levelsCreated\":" << side.nLevelsCreated << ",\"levelsDestroyed\":" << side.nLevelsDestroyed << ",\"orders\":" << side.nOrders
+           << ",\"priceLevels\":" << side.nPriceLevels << ",\"maxPriceLevels\":" << side.maxPriceLevels
+           << ",\"maxOrdersPerLevel\":" << side.maxOrdersPerLevel << "}";
+    }
+    os << "}" << std::endl;
+}
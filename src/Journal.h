@@ -0,0 +1,272 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <concepts>
+#include <iterator>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "OrderBook.h"
+
+/// Write-ahead journal of inbound requests.
+/// File layout: JournalFileHeader followed by fixed-size JournalRecords. The file is pre-allocated with zeros,
+/// so a record with seq 0 or a bad crc marks the end of the journal (the torn tail of a crash is dropped).
+
+namespace internal {
+/// CRC-32 (IEEE 802.3), table driven.
+inline uint32_t crc32(const void *data, size_t len, uint32_t crc = 0) {
+    static constexpr auto table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    auto *p = static_cast<const uint8_t *>(data);
+    crc     = ~crc;
+    for (size_t i = 0; i < len; ++i) crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+#ifdef _WIN32
+inline int file_open(const char *path, bool forWrite) {
+    return ::_open(path, forWrite ? (_O_RDWR | _O_CREAT | _O_BINARY) : (_O_RDONLY | _O_BINARY), _S_IREAD | _S_IWRITE);
+}
+inline void file_close(int fd) { ::_close(fd); }
+inline bool file_pwrite(int fd, const void *buf, size_t len, int64_t offset) {
+    return ::_lseeki64(fd, offset, SEEK_SET) == offset && ::_write(fd, buf, unsigned(len)) == int(len);
+}
+inline int64_t file_pread(int fd, void *buf, size_t len, int64_t offset) {
+    return ::_lseeki64(fd, offset, SEEK_SET) == offset ? ::_read(fd, buf, unsigned(len)) : -1;
+}
+inline int64_t file_size(int fd) { return ::_filelengthi64(fd); }
+inline bool    file_resize(int fd, int64_t size) { return ::_chsize_s(fd, size) == 0; }
+inline bool    file_preallocate(int fd, int64_t size) { return ::_chsize_s(fd, size) == 0; }
+inline bool    file_datasync(int fd) { return ::_commit(fd) == 0; }
+#else
+inline int  file_open(const char *path, bool forWrite) { return ::open(path, forWrite ? (O_RDWR | O_CREAT) : O_RDONLY, 0644); }
+inline void file_close(int fd) { ::close(fd); }
+inline bool file_pwrite(int fd, const void *buf, size_t len, int64_t offset) { return ::pwrite(fd, buf, len, offset) == ssize_t(len); }
+inline int64_t file_pread(int fd, void *buf, size_t len, int64_t offset) { return ::pread(fd, buf, len, offset); }
+inline int64_t file_size(int fd) {
+    struct stat st;
+    return ::fstat(fd, &st) == 0 ? int64_t(st.st_size) : -1;
+}
+inline bool file_resize(int fd, int64_t size) { return ::ftruncate(fd, size) == 0; }
+inline bool file_preallocate(int fd, int64_t size) {
+#ifdef __linux__
+    return ::posix_fallocate(fd, 0, size) == 0;
+#else
+    return ::ftruncate(fd, size) == 0;
+#endif
+}
+inline bool file_datasync(int fd) {
+#ifdef __linux__
+    return ::fdatasync(fd) == 0;
+#else
+    return ::fsync(fd) == 0;
+#endif
+}
+#endif
+} // namespace internal
+
+struct JournalFileHeader {
+    char     magic[8]{'J', 'Z', 'J', 'R', 'N', 'L', '0', '1'};
+    uint32_t recordSize{};
+    uint32_t reserved{};
+};
+
+struct JournalRecord {
+    uint64_t     seq{}; // starts from 1.
+    uint32_t     crc{}; // crc32 of request.
+    uint32_t     reserved{};
+    OrderRequest request{};
+};
+static_assert(sizeof(JournalRecord) == 48 && std::has_unique_object_representations_v<JournalRecord>, "JournalRecord has no padding");
+
+struct JournalConfig {
+    size_t groupCommitRecords = 64;       // write & fdatasync after this many records. 1 syncs every record.
+    size_t preallocateBytes   = 64 << 20; // file grows by this size when it's full.
+};
+
+/// Result of scanning a journal, used to resume appending.
+struct JournalScanResult {
+    bool     ok         = false; // false if the file cannot be opened or the header is invalid.
+    bool     notJournal = false; // the file isn't empty but has no valid journal header; it must not be overwritten.
+    uint64_t nRecords{}, lastSeq{};
+    int64_t  endOffset{}; // offset after the last valid record.
+};
+
+/// Counters to measure journal overhead. Only flush (write + fdatasync) is timed; append is a memcpy and a crc.
+struct JournalStats {
+    uint64_t nRecords{}, nFlushes{}, nBytes{};
+    uint64_t totalFlushNanos{}, maxFlushNanos{};
+};
+
+/// JournalWriter appends requests to a pre-allocated file. Records are batched in a fixed buffer and written
+/// with one write & fdatasync per group commit, so append never allocates nor blocks on IO between commits.
+class JournalWriter {
+    int                        _fd = -1;
+    JournalConfig              _config;
+    std::vector<JournalRecord> _buffer; // capacity is groupCommitRecords
+    uint64_t                   _nextSeq = 1;
+    int64_t                    _writeOffset{}, _allocatedSize{};
+    JournalStats               _stats;
+    bool                       _failed{}; // latched on an IO error of a flush: nothing is appended after the lost records.
+
+public:
+    JournalWriter() = default;
+    JournalWriter(const JournalWriter &) = delete;
+    JournalWriter &operator=(const JournalWriter &) = delete;
+    ~JournalWriter() { close(); }
+
+    /// Open or create a journal file.
+    /// @param resumeFrom result of scanJournal/replayJournal on an existing file; appending starts after its last valid record.
+    /// Without it, only a missing or empty file is created as a new journal: any other file is never truncated.
+    /// @return false on IO error, or if the file isn't empty and resumeFrom isn't ok.
+    bool open(const std::string &path, const JournalConfig &config = {}, const JournalScanResult &resumeFrom = {}) {
+        close();
+        _failed = false;
+        _config = config;
+        if (_config.groupCommitRecords == 0) _config.groupCommitRecords = 1;
+        _buffer.reserve(_config.groupCommitRecords);
+        if ((_fd = internal::file_open(path.c_str(), true)) < 0) return false;
+        if (resumeFrom.ok && resumeFrom.endOffset >= int64_t(sizeof(JournalFileHeader))) {
+            // drop the tail after the last valid record so that stale records are never replayed.
+            if (!internal::file_resize(_fd, resumeFrom.endOffset)) return false;
+            _allocatedSize = _writeOffset = resumeFrom.endOffset;
+            _nextSeq                      = resumeFrom.lastSeq + 1;
+        } else { // new journal
+            if (internal::file_size(_fd) != 0) { // not a journal, or a scan wasn't passed: keep the file.
+                internal::file_close(_fd);
+                _fd = -1;
+                return false;
+            }
+            JournalFileHeader header{.recordSize = sizeof(JournalRecord)};
+            _allocatedSize = 0;
+            if (!reserveSpace(sizeof(header)) || !internal::file_pwrite(_fd, &header, sizeof(header), 0)) return false;
+            _writeOffset = sizeof(header);
+            _nextSeq     = 1;
+        }
+        return true;
+    }
+
+    bool isOpen() const { return _fd >= 0; }
+    bool failed() const { return _failed; }
+
+    /// Append a request. It's durable after the group commit that contains it.
+    /// @return false on IO error, now or in an earlier flush; the journal doesn't accept records after an error.
+    bool append(const OrderRequest &req) {
+        if (_failed) return false;
+        JournalRecord &rec = _buffer.emplace_back();
+        rec.seq            = _nextSeq++;
+        rec.request        = req;
+        rec.crc            = internal::crc32(&rec.request, sizeof(rec.request), internal::crc32(&rec.seq, sizeof(rec.seq)));
+        ++_stats.nRecords;
+        if (_buffer.size() >= _config.groupCommitRecords) return flush();
+        return true;
+    }
+
+    /// Write buffered records and fdatasync.
+    /// @return false on IO error. The records stay buffered and the error is latched, so that the journal never has a hole that
+    /// would make recovery drop the records after it.
+    bool flush() {
+        if (_failed) return false;
+        if (_buffer.empty() || _fd < 0) return _fd >= 0;
+        auto   start = std::chrono::steady_clock::now();
+        size_t bytes = _buffer.size() * sizeof(JournalRecord);
+        bool   ok    = reserveSpace(_writeOffset + bytes) && internal::file_pwrite(_fd, _buffer.data(), bytes, _writeOffset) &&
+                  internal::file_datasync(_fd);
+        if (ok) {
+            _writeOffset += bytes;
+            _buffer.clear();
+        } else {
+            _failed = true;
+        }
+        uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        ++_stats.nFlushes;
+        _stats.nBytes += bytes;
+        _stats.totalFlushNanos += nanos;
+        _stats.maxFlushNanos = std::max(_stats.maxFlushNanos, nanos);
+        return ok;
+    }
+
+    void close() {
+        if (_fd < 0) return;
+        flush();
+        internal::file_close(_fd);
+        _fd = -1;
+    }
+
+    const JournalStats &stats() const { return _stats; }
+    uint64_t            nextSeq() const { return _nextSeq; }
+
+private:
+    bool reserveSpace(int64_t size) {
+        if (size <= _allocatedSize) return true;
+        int64_t newSize = std::max<int64_t>(size, _allocatedSize + int64_t(_config.preallocateBytes));
+        if (!internal::file_preallocate(_fd, newSize)) return false;
+        _allocatedSize = newSize;
+        return true;
+    }
+};
+
+/// Read all valid records of a journal. Stops at the first empty, out-of-sequence or corrupted record.
+/// @param onRecord  void(const JournalRecord &)
+inline JournalScanResult scanJournal(const std::string &path, std::invocable<const JournalRecord &> auto &&onRecord) {
+    JournalScanResult res;
+    int               fd = internal::file_open(path.c_str(), false);
+    if (fd < 0) return res;
+    JournalFileHeader header, expected{.recordSize = sizeof(JournalRecord)};
+    if (internal::file_pread(fd, &header, sizeof(header), 0) != sizeof(header) || std::memcmp(&header, &expected, sizeof(header)) != 0) {
+        res.notJournal = internal::file_size(fd) != 0;
+        internal::file_close(fd);
+        return res;
+    }
+    res.ok        = true;
+    res.endOffset = sizeof(header);
+
+    std::vector<JournalRecord> batch(4096);
+    for (bool done = false; !done;) {
+        int64_t n = internal::file_pread(fd, batch.data(), batch.size() * sizeof(JournalRecord), res.endOffset);
+        if (n <= 0) break;
+        size_t nRecords = size_t(n) / sizeof(JournalRecord);
+        done            = nRecords < batch.size();
+        for (size_t i = 0; i < nRecords; ++i) {
+            const JournalRecord &rec = batch[i];
+            if (rec.seq != res.lastSeq + 1 ||
+                rec.crc != internal::crc32(&rec.request, sizeof(rec.request), internal::crc32(&rec.seq, sizeof(rec.seq)))) {
+                done = true;
+                break;
+            }
+            onRecord(rec);
+            res.lastSeq = rec.seq;
+            ++res.nRecords;
+            res.endOffset += sizeof(JournalRecord);
+        }
+    }
+    internal::file_close(fd);
+    return res;
+}
+
+/// Recover order books by replaying a journal into them.
+/// @param books  random access range of OrderBook indexed by request bookID. Requests of unknown books are skipped.
+/// @param afterSeq  skip records up to this seq, e.g., BookSnapshot::journalSeq of restored books.
+inline JournalScanResult replayJournal(const std::string &path, auto &&books, uint64_t afterSeq = 0) {
+    return scanJournal(path, [&](const JournalRecord &rec) {
+        if (rec.seq > afterSeq && rec.request.bookID < std::size(books)) books[rec.request.bookID].handleRequest(rec.request);
+    });
+}
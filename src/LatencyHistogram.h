@@ -0,0 +1,111 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ostream>
+#include <stdint.h>
+
+#include "TscClock.h"
+
+/// LatencyHistogram is a fixed-memory log-linear (HDR-style) histogram of TSC ticks. Values below 2^SubBucketBits are counted exactly;
+/// each higher power of 2 is split into 2^SubBucketBits linear sub-buckets, so a bucket's width is within 1/32 of its values.
+/// Recording is a bit_width, a shift and an increment; no allocation, no branches on the value range.
+class LatencyHistogram {
+public:
+    static constexpr int      SubBucketBits  = 5;
+    static constexpr uint64_t SubBucketCount = uint64_t(1) << SubBucketBits;
+    static constexpr size_t   NumBuckets     = (64 - SubBucketBits + 1) * SubBucketCount;
+
+private:
+    std::array<uint64_t, NumBuckets> _counts{};
+    uint64_t                         _count{}, _sum{}, _max{};
+    uint64_t                         _nScopes{}; // LatencyScope sampling counter
+
+public:
+    static size_t bucketIndex(uint64_t value) {
+        int shift = std::max(int(std::bit_width(value)) - SubBucketBits - 1, 0);
+        return (size_t(shift) << SubBucketBits) + size_t(value >> shift);
+    }
+    /// @return the highest value that falls into the bucket.
+    static uint64_t bucketUpperValue(size_t index) {
+        size_t group = index >> SubBucketBits;
+        if (group == 0) return index;
+        uint64_t subBucket = (index & (SubBucketCount - 1)) + SubBucketCount;
+        return ((subBucket + 1) << (group - 1)) - 1;
+    }
+
+    void record(uint64_t ticks) {
+        ++_counts[bucketIndex(ticks)];
+        ++_count;
+        _sum += ticks;
+        _max = std::max(_max, ticks);
+    }
+
+    /// @param p  percentile in [0, 1].
+    /// @return the upper value of the bucket containing the p-th value, capped by max. 0 if empty.
+    uint64_t percentile(double p) const {
+        uint64_t rank = std::max<uint64_t>(uint64_t(std::ceil(p * _count)), 1), cumulative = 0;
+        for (size_t i = 0; i < NumBuckets && _count; ++i) {
+            cumulative += _counts[i];
+            if (cumulative >= rank) return std::min(bucketUpperValue(i), _max);
+        }
+        return 0;
+    }
+
+    /// @return true for 1 of every sampleEvery calls.
+    bool sample(uint32_t sampleEvery) { return sampleEvery <= 1 || ++_nScopes % sampleEvery == 0; }
+
+    void merge(const LatencyHistogram &other) {
+        for (size_t i = 0; i < NumBuckets; ++i) _counts[i] += other._counts[i];
+        _count += other._count;
+        _sum += other._sum;
+        _max = std::max(_max, other._max);
+    }
+    void reset() { *this = LatencyHistogram{}; }
+
+    uint64_t count() const { return _count; }
+    uint64_t max() const { return _max; }
+    double   mean() const { return _count ? double(_sum) / _count : 0; }
+
+    static void printHeader(std::ostream &os) {
+        char buf[128];
+        std::snprintf(
+                buf, sizeof(buf), "%-24s %12s %10s %10s %10s %10s %10s %10s\n", "latency(ns)", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+        os << buf;
+    }
+    /// print count, mean and percentiles in nanoseconds.
+    void print(std::ostream &os, const char *name) const {
+        char buf[160];
+        std::snprintf(buf,
+                      sizeof(buf),
+                      "%-24s %12llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                      name,
+                      (unsigned long long)_count,
+                      TscClock::toNanos(1) * mean(),
+                      TscClock::toNanos(percentile(0.5)),
+                      TscClock::toNanos(percentile(0.9)),
+                      TscClock::toNanos(percentile(0.99)),
+                      TscClock::toNanos(percentile(0.999)),
+                      TscClock::toNanos(_max));
+        os << buf;
+    }
+};
+
+/// LatencyScope records the TSC ticks from construction to destruction of 1 in SampleEvery scopes of a histogram.
+/// The two TSC reads dominate the overhead (~25 cycles each), sampling amortizes them to a counter increment per scope.
+template<uint32_t SampleEvery = 1>
+class LatencyScope {
+    LatencyHistogram &_histogram;
+    uint64_t          _start{};
+    bool              _sampled;
+
+public:
+    explicit LatencyScope(LatencyHistogram &histogram) : _histogram(histogram), _sampled(histogram.sample(SampleEvery)) {
+        if (_sampled) _start = TscClock::now();
+    }
+    ~LatencyScope() {
+        if (_sampled) _histogram.record(TscClock::now() - _start);
+    }
+};
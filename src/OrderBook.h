@@ -1,10 +1,21 @@
+#pragma once
 #include <unordered_map>
 #include <vector>
 #include <array>
 #include <concepts>
 #include <list>
+#include <map>
+#include <span>
 #include <algorithm>
+#include <iterator>
 #include <iostream>
+#include <string>
+#include <functional>
+#include <type_traits>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <cstdlib>
 #include <assert.h>
 #include <stdint.h>
 
@@ -30,13 +41,16 @@ using OrderID    = uint64_t;
 using CentPrice  = int;
 using FloatPrice = double;
 using Qty        = int;
+using OwnerID    = uint32_t; // account or firm of an order; 0 is no owner.
+using SessionID  = uint32_t; // gateway session that entered an order; 0 is no session. SessionIDs are small dense integers.
+using Timestamp  = uint64_t; // in the caller's units, e.g. nanoseconds since epoch.
 
-enum class Side {
+enum class Side : uint8_t {
     Buy,
     Sell,
 };
 
-enum class MsgType {
+enum class MsgType : uint8_t {
     AddOrderRequest      = 0,
     CancelOrderRequest   = 1,
     TradeEvent           = 2,
@@ -45,6 +59,7 @@ enum class MsgType {
     // more types
     PartialCancelRequest = 5,
     ReplaceOrderRequest  = 6,
+    AmendOrderRequest    = 7,
 };
 
 enum class ErrCode {
@@ -52,6 +67,41 @@ enum class ErrCode {
     UnknownOrderID,
     QtyTooLarge,
     QtyTooSmall,
+    CrossesBook,    // a bulk loaded order would match the other side.
+    NotFillable,    // a fill-or-kill order can't be fully filled.
+    WouldTrade,     // a post-only order would match the other side.
+    Expired,        // a good-till-time order's expiry time has passed.
+    Pegged,         // a pegged order can't be amended, only cancelled.
+    InvalidSession, // sessionID > SessionIndex::MaxSessionID
+    // pre-trade risk rejects, see PreTradeRisk.
+    QtyLimit,       // qty > maxQty
+    NotionalLimit,  // qty * price > maxNotional
+    PriceBand,      // price is further than priceBand from the reference price.
+    OpenOrderLimit, // the account has maxOpenOrders resting orders.
+    PositionLimit,  // the account's position would exceed maxPosition if the order fully fills.
+    UnknownAccount, // ownerID > PreTradeRisk::MaxOwnerID has no account.
+};
+
+/// TimeInForce of an add request: what happens to the qty left after matching.
+enum class TimeInForce : uint8_t {
+    GTC, // good till cancel: it rests on the book.
+    IOC, // immediate or cancel: it's discarded, the order never rests.
+    FOK, // fill or kill: the order is fully filled, or rejected with ErrCode::NotFillable without a trade.
+};
+
+/// PegType is the reference price of a pegged order. Pegged orders aren't displayed: they're not in depth, BBO or market data.
+enum class PegType : uint8_t {
+    None,     // not pegged
+    Primary,  // the best price of its side.
+    Midpoint, // the middle of the best bid and ask; rounded down for a buy order and up for a sell order.
+};
+
+/// SelfTrade is what happens when an aggressive order would match a resting order of the same owner. No trade is reported.
+enum class SelfTrade : uint8_t {
+    CancelResting,    // cancel the resting order and keep matching.
+    CancelAggressive, // cancel the rest of the aggressive order.
+    CancelBoth,
+    Decrement, // reduce both orders by the qty that would have traded; an order with no qty left is cancelled.
 };
 
 /// TradeMsg is used for TradeReporter to report a trade.
@@ -68,262 +118,1869 @@ struct TradeMsg {
     Fill      restingOrderFill;
 };
 
+/// PostOnly tells OrderBook::addPostOnlyOrder what to do with an order that would match the other side.
+enum class PostOnly : uint8_t {
+    Reject, // report ErrCode::WouldTrade
+    Slide,  // rest one tick away from the other side's best price
+};
+
+/// OrderAckMsg reports the price a post-only order rests at.
+struct OrderAckMsg {
+    OrderID   orderID;
+    Side      side;
+    Qty       qty;
+    CentPrice price;          // the order rests at price.
+    CentPrice requestedPrice; // price != requestedPrice if the order slid.
+};
+
+/// SelfTradeMsg reports a prevented self trade: the qty cancelled from each order.
+struct SelfTradeMsg {
+    SelfTrade mode;
+    OrderID   aggressiveOrderID;
+    OrderID   restingOrderID;
+    Qty       aggressiveCancelQty;
+    Qty       restingCancelQty; // includes the reserve of a cancelled iceberg order.
+};
+
+/// BulkOrder is a resting order loaded by OrderBook::bulkLoad.
+struct BulkOrder {
+    OrderID   orderID{};
+    Side      side{};
+    Qty       qty{};
+    CentPrice price{};
+};
+
+/// BulkCrossing tells OrderBook::bulkLoad what to do with an order that would match the other side.
+enum class BulkCrossing : uint8_t {
+    Reject, // report ErrCode::CrossesBook
+    Match,  // match it like matchAddNewOrder
+};
+
+/// LevelUpdateMsg is an incremental L2 update of a price level with its new aggregates.
+struct LevelUpdateMsg {
+    enum Type : uint8_t { New, Change, Delete };
+
+    Type      type;
+    Side      side;
+    CentPrice price;
+    int64_t   totalQty; // 0 for Delete
+    uint32_t  nOrders;  // 0 for Delete
+};
+
+/// OrderEventMsg is an L3 event of a resting order.
+struct OrderEventMsg {
+    enum Type : uint8_t {
+        Add,     // an order rests on the book.
+        Cancel,  // an order is removed without trading, or an amend trades it away as aggressive order.
+        Modify,  // qty/price/orderID change of a resting order. A price change or qty increase moves it to the back of the level.
+        Execute, // a resting order trades. It's removed from book if leaveQty is 0.
+    };
+
+    Type      type;
+    Side      side;
+    OrderID   orderID;
+    OrderID   origOrderID; // orderID before a Modify that changes it; same as orderID otherwise.
+    CentPrice price;       // price after the event
+    Qty       qty;         // Add: added qty; Cancel: cancelled qty; Modify: new qty; Execute: executed qty.
+    Qty       leaveQty;    // qty left on book after the event.
+};
+
+/// ExpiryMsg reports a good-till-time order cancelled at its expiry time.
+struct ExpiryMsg {
+    OrderID   orderID;
+    Side      side;
+    CentPrice price;
+    Qty       qty; // cancelled qty, including the reserve of an iceberg order.
+    Timestamp expireTime;
+};
+
+/// CancelReport selects the events of a mass cancel (OrderBook::cancelAll, cancelSide, cancelPriceRange).
+enum class CancelReport : uint8_t {
+    PerOrder, // an L3 Cancel per order and an L2 Delete per level, to a MarketDataReporter.
+    Summary,  // one MassCancelMsg, to a MassCancelReporter.
+};
+
+/// MassCancelMsg summarizes a mass cancel: all orders of the scope with a price in [loPrice, hiPrice] are removed.
+struct MassCancelMsg {
+    enum Scope : uint8_t {
+        All,        // both sides; side is not used.
+        OneSide,    // one side.
+        PriceRange, // a price range of one side.
+    };
+
+    Scope     scope;
+    Side      side;
+    CentPrice loPrice, hiPrice;
+    uint64_t  nOrders;
+    uint64_t  nLevels;
+};
+
+/// OrderRequest is a parsed inbound request. It has no implicit padding so that it can be journaled as raw bytes.
+struct OrderRequest {
+    OrderID     orderID{};
+    OrderID     newOrderID{}; // ReplaceOrderRequest, AmendOrderRequest
+    Qty         qty{};        // PartialCancelRequest: cancelled qty
+    CentPrice   price{};
+    uint32_t    bookID{}; // instrument index
+    MsgType     msgType{};
+    Side        side{};
+    TimeInForce timeInForce{}; // AddOrderRequest; 0 (GTC) in journals written before it was added.
+    uint8_t     reserved[1]{};
+};
+static_assert(sizeof(OrderRequest) == 32 && std::has_unique_object_representations_v<OrderRequest>, "OrderRequest has no padding");
+
+#include "TimingWheel.h"
+
+#ifdef JZ_LATENCY_HISTOGRAM
+#include "LatencyHistogram.h"
+
+/// latency of OrderBook requests by MsgType, in TSC ticks. Books are driven by one thread, so histograms aren't synchronized.
+inline std::array<LatencyHistogram, 8> requestLatencies;
+
+/// print non-empty request latency histograms with percentiles in nanoseconds.
+inline void printRequestLatencies(std::ostream &os) {
+    static const char *requestNames[8] = {
+            "AddOrderRequest", "CancelOrderRequest", "", "", "", "PartialCancelRequest", "ReplaceOrderRequest", "AmendOrderRequest"};
+    LatencyHistogram::printHeader(os);
+    for (size_t i = 0; i < requestLatencies.size(); ++i)
+        if (requestLatencies[i].count()) requestLatencies[i].print(os, requestNames[i]);
+}
+
+#ifndef JZ_LATENCY_SAMPLE_EVERY
+#define JZ_LATENCY_SAMPLE_EVERY 1 // time 1 of every N requests of a type.
+#endif
+
+#define JZ_LATENCY_SCOPE(msgType) LatencyScope<JZ_LATENCY_SAMPLE_EVERY> _latencyScope(requestLatencies[size_t(msgType)])
+#else
+#define JZ_LATENCY_SCOPE(msgType) // compiled away
+#endif
+
 template<class T>
 concept BookEventReporter = requires(T t, TradeMsg tradeMsg, OrderID orderID, MsgType msgType, ErrCode errCode, const std::string &errMsg) {
     { t.onTrade(tradeMsg) } -> std::same_as<void>;
     { t.onError(orderID, msgType, errCode, errMsg) } -> std::same_as<void>;
 };
 
+/// MarketDataReporter is optionally implemented by a BookEventReporter to receive incremental L2 level updates and L3 order events.
+/// Reporters that don't implement it don't pay for building the events.
+template<class T>
+concept MarketDataReporter = requires(T t, LevelUpdateMsg levelMsg, OrderEventMsg orderMsg) {
+    { t.onLevelUpdate(levelMsg) } -> std::same_as<void>;
+    { t.onOrderEvent(orderMsg) } -> std::same_as<void>;
+};
+
+/// ExpiryReporter is optionally implemented by a BookEventReporter to receive ExpiryMsg.
+template<class T>
+concept ExpiryReporter = requires(T t, ExpiryMsg msg) {
+    { t.onExpiry(msg) } -> std::same_as<void>;
+};
+
+/// MassCancelReporter is optionally implemented by a BookEventReporter to receive MassCancelMsg of CancelReport::Summary mass cancels.
+template<class T>
+concept MassCancelReporter = requires(T t, MassCancelMsg msg) {
+    { t.onMassCancel(msg) } -> std::same_as<void>;
+};
+
+/// OrderAckReporter is optionally implemented by a BookEventReporter to receive OrderAckMsg.
+template<class T>
+concept OrderAckReporter = requires(T t, OrderAckMsg msg) {
+    { t.onOrderAck(msg) } -> std::same_as<void>;
+};
+
+/// SelfTradeReporter is optionally implemented by a BookEventReporter to receive SelfTradeMsg.
+template<class T>
+concept SelfTradeReporter = requires(T t, SelfTradeMsg msg) {
+    { t.onSelfTrade(msg) } -> std::same_as<void>;
+};
+
+/// SideBookStats are counters and the shape of one side of a book.
+struct SideBookStats {
+    uint64_t nAdds{};    // orders rested on this side
+    uint64_t nCancels{}; // orders cancelled, including partial cancels to 0 and amends that fully trade
+    uint64_t nFills{};   // resting order fills, partial or full
+    uint64_t nLevelsCreated{}, nLevelsDestroyed{};
+    size_t   nOrders{}, nPriceLevels{};
+    size_t   maxPriceLevels{}, maxOrdersPerLevel{}; // high-water marks
+};
+
+/// DepthLevel is an aggregated (L2) price level.
+struct DepthLevel {
+    CentPrice price{};
+    int64_t   totalQty{};
+    uint32_t  nOrders{}; // 0 if there's no level.
+
+    bool operator==(const DepthLevel &) const = default;
+};
+
+/// TopOfBook is the best bid & ask levels. A side without orders has nOrders == 0.
+struct TopOfBook {
+    DepthLevel bid, ask;
+
+    bool operator==(const TopOfBook &) const = default;
+};
+
+/// BBOReporter is optionally implemented by a BookEventReporter to receive conflated best bid & offer updates:
+/// at most one per request, or per batch (see OrderBook::beginBatch), and only when the top changed.
+template<class T>
+concept BBOReporter = requires(T t, TopOfBook bbo) {
+    { t.onBBO(bbo) } -> std::same_as<void>;
+};
+
+/// RiskStage is the pre-trade risk stage of an OrderBook, checked before an order touches the book: limit, market and pegged orders,
+/// released stop orders, and amends or replaces that raise qty or change price. Enabled is false for a stage without checks; the
+/// account hooks are called only if TracksAccounts, so a disabled stage compiles away.
+template<class T>
+concept RiskStage = requires(T t, const T ct, OwnerID ownerID, Side side, Qty qty, CentPrice price, std::optional<CentPrice> (*ref)()) {
+    { T::Enabled } -> std::convertible_to<bool>;
+    { T::TracksAccounts } -> std::convertible_to<bool>;
+    { ct.check(ownerID, side, qty, price, ref, qty) } -> std::same_as<std::optional<ErrCode>>; // the last qty is amended from.
+    t.onRest(ownerID, side, qty);   // an order of the owner rests with qty.
+    t.onResize(ownerID, side, qty); // the qty of a resting order of the owner changes by qty: a fill, an amend or a decrement.
+    t.onRemove(ownerID, side, qty); // a resting order of the owner is filled or cancelled with qty left.
+    t.onFill(ownerID, side, qty);   // an order of the owner trades.
+    t.clearOpenOrders();            // all resting orders are cancelled.
+};
+
+/// RiskCheck flags select the checks of a PreTradeRisk at compile time.
+struct RiskCheck {
+    enum : unsigned {
+        MaxQty      = 1,      // fat finger: qty <= maxQty
+        MaxNotional = 1 << 1, // fat finger: qty * price <= maxNotional
+        PriceBand   = 1 << 2, // |price - reference price| <= priceBand. The reference is the last trade, else the BBO.
+        OpenOrders  = 1 << 3, // per account: resting orders < maxOpenOrders
+        Position    = 1 << 4, // per account: |position| <= maxPosition if the order and the open orders of its side fully fill,
+                              // unless it reduces the position.
+        All         = (1 << 5) - 1,
+    };
+};
+
+/// RiskLimits of a PreTradeRisk. maxOpenOrders and maxPosition are the default limits of each account.
+struct RiskLimits {
+    Qty       maxQty        = std::numeric_limits<Qty>::max();
+    int64_t   maxNotional   = std::numeric_limits<int64_t>::max(); // in cents
+    CentPrice priceBand     = std::numeric_limits<CentPrice>::max();
+    uint32_t  maxOpenOrders = std::numeric_limits<uint32_t>::max();
+    int64_t   maxPosition   = std::numeric_limits<int64_t>::max();
+};
+
+/// PreTradeRisk checks fat-finger limits of orders and the open-order and position limits of their account (OwnerID). Only the
+/// checks in Checks are compiled; PreTradeRisk<0> is no check at all. Accounts are in a dense vector indexed by OwnerID, grown when an
+/// account is first seen, so a check is a few compares and an indexed load, no hashing. Orders without owner have no account limits;
+/// an order of an owner above MaxOwnerID is rejected with UnknownAccount, and fills of its unchecked orders aren't tracked.
+template<unsigned Checks>
+class PreTradeRisk {
+public:
+    static constexpr bool    Enabled        = Checks != 0;
+    static constexpr bool    TracksAccounts = (Checks & (RiskCheck::OpenOrders | RiskCheck::Position)) != 0;
+    static constexpr OwnerID MaxOwnerID     = (1 << 20) - 1; // bounds the dense vector of accounts.
+
+private:
+    struct Account {
+        int64_t  position{}; // bought - sold qty
+        uint32_t openOrders{};
+        uint32_t maxOpenOrders{};
+        int64_t  maxPosition{};
+        int64_t  openBuyQty{}; // leaves qty of resting orders
+        int64_t  openSellQty{};
+    };
+
+    RiskLimits           _limits;
+    std::vector<Account> _accounts; // by OwnerID
+
+public:
+    explicit PreTradeRisk(const RiskLimits &limits = {}) : _limits(limits) {}
+
+    const RiskLimits &limits() const { return _limits; }
+    /// set the limits, and the account limits of all accounts.
+    void setLimits(const RiskLimits &limits) {
+        _limits = limits;
+        for (Account &account : _accounts) account.maxOpenOrders = limits.maxOpenOrders, account.maxPosition = limits.maxPosition;
+    }
+    /// @return false if ownerID is 0 or > MaxOwnerID.
+    bool setAccountLimits(OwnerID ownerID, uint32_t maxOpenOrders, int64_t maxPosition) {
+        Account *account = accountOf(ownerID);
+        if (!account) return false;
+        account->maxOpenOrders = maxOpenOrders;
+        account->maxPosition   = maxPosition;
+        return true;
+    }
+    int64_t  position(OwnerID ownerID) const { return ownerID < _accounts.size() ? _accounts[ownerID].position : 0; }
+    uint32_t openOrders(OwnerID ownerID) const { return ownerID < _accounts.size() ? _accounts[ownerID].openOrders : 0; }
+    int64_t  openQty(OwnerID ownerID, Side side) const { return ownerID < _accounts.size() ? openQtyOf(_accounts[ownerID], side) : 0; }
+
+    /// @param referencePrice  returns the reference price of the price band, nullopt if there's none. It's called only if needed.
+    /// @param amendedQty  leaves qty of the resting order an amend changes, 0 for a new order. It's already in the account, so it
+    /// doesn't count as another open order and qty replaces it in the open qty.
+    /// @return the ErrCode of the first failed check, nullopt if the order passes.
+    template<class ReferencePrice>
+    std::optional<ErrCode> check(
+            OwnerID ownerID, Side side, Qty qty, CentPrice price, ReferencePrice &&referencePrice, Qty amendedQty = 0) const {
+        if constexpr ((Checks & RiskCheck::MaxQty) != 0) {
+            if (qty > _limits.maxQty) return ErrCode::QtyLimit;
+        }
+        if constexpr ((Checks & RiskCheck::MaxNotional) != 0) {
+            if (int64_t(qty) * price > _limits.maxNotional) return ErrCode::NotionalLimit;
+        }
+        if constexpr ((Checks & RiskCheck::PriceBand) != 0) {
+            std::optional<CentPrice> reference = referencePrice();
+            if (reference && std::abs(int64_t(price) - *reference) > _limits.priceBand) return ErrCode::PriceBand;
+        }
+        if constexpr (TracksAccounts) {
+            if (!ownerID) return std::nullopt;
+            if (ownerID > MaxOwnerID) return ErrCode::UnknownAccount;
+            Account account = ownerID < _accounts.size() ? _accounts[ownerID] : newAccount();
+            if constexpr ((Checks & RiskCheck::OpenOrders) != 0) {
+                if (!amendedQty && account.openOrders >= account.maxOpenOrders) return ErrCode::OpenOrderLimit;
+            }
+            if constexpr ((Checks & RiskCheck::Position) != 0) { // worst case: the open orders of the side fill too.
+                int64_t position = side == Side::Buy ? account.position + account.openBuyQty - amendedQty + qty
+                                                     : account.position - account.openSellQty + amendedQty - qty;
+                if (std::abs(position) > account.maxPosition && std::abs(position) > std::abs(account.position)) return ErrCode::PositionLimit;
+            }
+        }
+        return std::nullopt;
+    }
+
+    void onRest(OwnerID ownerID, Side side, Qty qty) {
+        if (Account *account = accountOf(ownerID)) {
+            ++account->openOrders;
+            openQtyOf(*account, side) += qty;
+        }
+    }
+    void onResize(OwnerID ownerID, Side side, Qty qty) {
+        if (Account *account = accountOf(ownerID)) openQtyOf(*account, side) += qty;
+    }
+    void onRemove(OwnerID ownerID, Side side, Qty qty) {
+        if (Account *account = accountOf(ownerID)) {
+            --account->openOrders;
+            openQtyOf(*account, side) -= qty;
+        }
+    }
+    void onFill(OwnerID ownerID, Side side, Qty qty) {
+        if (Account *account = accountOf(ownerID)) account->position += side == Side::Buy ? qty : -qty;
+    }
+    void clearOpenOrders() {
+        for (Account &account : _accounts) account.openOrders = 0, account.openBuyQty = account.openSellQty = 0;
+    }
+
+private:
+    static int64_t       &openQtyOf(Account &account, Side side) { return side == Side::Buy ? account.openBuyQty : account.openSellQty; }
+    static const int64_t &openQtyOf(const Account &account, Side side) { return side == Side::Buy ? account.openBuyQty : account.openSellQty; }
+
+    Account newAccount() const { return Account{.maxOpenOrders = _limits.maxOpenOrders, .maxPosition = _limits.maxPosition}; }
+
+    /// @return nullptr if ownerID has no account: 0 or > MaxOwnerID.
+    Account *accountOf(OwnerID ownerID) {
+        if (!ownerID || ownerID > MaxOwnerID) return nullptr;
+        if (ownerID >= _accounts.size()) [[unlikely]] _accounts.resize(size_t(ownerID) + 1, newAccount());
+        return &_accounts[ownerID];
+    }
+};
+
+using NoRiskChecks = PreTradeRisk<0>;
+static_assert(RiskStage<NoRiskChecks> && RiskStage<PreTradeRisk<RiskCheck::All>>);
+
 namespace internal {
-/// @brief OrderInfo contains order info needed by order book.
+/// @brief OrderInfo contains order info needed by order book. Its price is the key of its level.
 struct OrderInfo {
-    OrderID   orderID{};
-    Qty       qty{};
+    OrderID orderID{};
+    Qty     qty{}; // displayed qty, counted in the level's totalQty.
+    OwnerID ownerID{};
+    Qty     displayQty{}; // iceberg order: qty displayed after each refresh; 0 otherwise.
+    Qty     hiddenQty{};  // iceberg order: reserve that isn't in the level's totalQty.
+};
+static_assert(sizeof(OrderInfo) == 24, "OrderInfo is in every list node of the matching loop");
+
+/// SnapshotLevel is a price level in a BookSnapshot, followed by nOrders OrderInfo.
+struct SnapshotLevel {
     CentPrice price{};
+    uint32_t  nOrders{};
 };
 
-using OrderList           = std::list<OrderInfo>;
-using OrderListByPriceMap = std::unordered_map<CentPrice, OrderList>;
+using OrderList = std::list<OrderInfo>;
+
+/// @brief PriceLevel is the orders at a price in time priority and their aggregated qty.
+struct PriceLevel {
+    OrderList orderList;
+    int64_t   totalQty{};
+};
+
+using ComparePrice        = bool (*)(CentPrice x, CentPrice y);
+using PriceLevelMap       = std::map<CentPrice, PriceLevel, ComparePrice>; // in priority order: begin() is the best price.
+using OrderListByPriceMap = std::unordered_map<CentPrice, PriceLevelMap::iterator>;
+
+/// PegQueue holds the pegged orders of a PegType of a side in time priority. They all have the price computed from the top of book,
+/// so a BBO change doesn't touch them.
+struct PegQueue {
+    OrderList orderList;
+    int64_t   totalQty{};
+};
+
+/// PegPrices are the prices of the pegged orders of a side by PegType - 1, if their reference prices exist.
+using PegPrices = std::array<std::optional<CentPrice>, 2>;
+
+using ExpiryWheel = TimingWheel<OrderID>; // good-till-time orders by expiry time
+
+/// SessionIndex links the orders of each gateway session in an intrusive list, so that the orders of a session are found without
+/// scanning the orderID map. The links are slots in a pool, found by orderID in a side table so that OrderKey only carries a flag;
+/// the lists are in a dense vector by SessionID. Adding and removing an order are O(1); releasing a session is O(orders of the
+/// session) and frees its slots with one splice.
+class SessionIndex {
+public:
+    static constexpr SessionID MaxSessionID = (1 << 16) - 1; // bounds the dense vector of lists.
+
+private:
+    using SlotID                   = uint32_t;
+    static constexpr SlotID NoSlot = UINT32_MAX;
 
-/// OrderKey identifies an order in a book.
+    struct Slot {
+        OrderID   orderID{};
+        SessionID sessionID{};
+        SlotID    prev = NoSlot, next = NoSlot; // in its session; next is the free list link of a free slot.
+    };
+    struct List {
+        SlotID first = NoSlot, last = NoSlot;
+    };
+
+    std::vector<Slot>                   _slots;
+    std::vector<List>                   _lists; // by SessionID
+    std::unordered_map<OrderID, SlotID> _slotByOrderID;
+    SlotID                              _freeList = NoSlot;
+
+public:
+    size_t size() const { return _slotByOrderID.size(); }
+
+    /// @param sessionID  <= MaxSessionID
+    /// @param orderID    not in any session.
+    void add(SessionID sessionID, OrderID orderID) {
+        assert(sessionID <= MaxSessionID);
+        SlotID id = _freeList;
+        if (id != NoSlot) {
+            _freeList = _slots[id].next;
+        } else {
+            id = SlotID(_slots.size());
+            _slots.emplace_back();
+        }
+        if (sessionID >= _lists.size()) _lists.resize(size_t(sessionID) + 1);
+        List &list = _lists[sessionID];
+        _slots[id] = Slot{.orderID = orderID, .sessionID = sessionID, .prev = list.last, .next = NoSlot};
+        if (list.last != NoSlot) _slots[list.last].next = id;
+        else list.first = id;
+        list.last = id;
+        _slotByOrderID.emplace(orderID, id);
+    }
+
+    /// @param orderID  in a session.
+    void remove(OrderID orderID) {
+        auto it = _slotByOrderID.find(orderID);
+        assert(it != _slotByOrderID.end());
+        SlotID id   = it->second;
+        Slot  &slot = _slots[id];
+        List &list = _lists[slot.sessionID];
+        if (slot.prev != NoSlot) _slots[slot.prev].next = slot.next;
+        else list.first = slot.next;
+        if (slot.next != NoSlot) _slots[slot.next].prev = slot.prev;
+        else list.last = slot.prev;
+        slot.next = _freeList;
+        _freeList = id;
+        _slotByOrderID.erase(it);
+    }
+
+    /// @param orderID  in a session; newOrderID takes its place.
+    void setOrderID(OrderID orderID, OrderID newOrderID) {
+        auto node                     = _slotByOrderID.extract(orderID);
+        node.key()                    = newOrderID;
+        _slots[node.mapped()].orderID = newOrderID;
+        _slotByOrderID.insert(std::move(node));
+    }
+
+    /// Empty a session's list, calling onOrder(orderID) for each order in the order they were added, then free its slots at once.
+    /// onOrder must not add or remove slots.
+    /// @return number of orders.
+    template<class OnOrder>
+    size_t release(SessionID sessionID, OnOrder &&onOrder) {
+        if (sessionID >= _lists.size() || _lists[sessionID].first == NoSlot) return 0;
+        List   list = std::exchange(_lists[sessionID], List{});
+        size_t n    = 0;
+        for (SlotID id = list.first; id != NoSlot; id = _slots[id].next, ++n) {
+            _slotByOrderID.erase(_slots[id].orderID);
+            onOrder(_slots[id].orderID);
+        }
+        _slots[list.last].next = _freeList;
+        _freeList              = list.first;
+        return n;
+    }
+
+    void clear() {
+        _slots.clear();
+        _lists.clear();
+        _slotByOrderID.clear();
+        _freeList = NoSlot;
+    }
+};
+
+/// OrderKey identifies an order in a book. side, peg, inSession and expiryTimer fit in 8 bytes.
 struct OrderKey {
-    Side                          side; // used for cancel request which doesn't have side info.
-    OrderList::iterator           iterList;
-    OrderListByPriceMap::iterator iterMap;
+    Side                    side;                               // used for cancel request which doesn't have side info.
+    PegType                 peg         = PegType::None;        // a pegged order is in a PegQueue, iterMap isn't used.
+    bool                    inSession   = false;                // order of a gateway session, linked in the SessionIndex.
+    ExpiryWheel::TimerID    expiryTimer = ExpiryWheel::NoTimer; // good-till-time order
+    OrderList::iterator     iterList;
+    PriceLevelMap::iterator iterMap;
 };
+static_assert(sizeof(OrderKey) == 24, "OrderKey is in every node of the orderID map");
 
 using OrderKeyByOrderIDMap = std::unordered_map<OrderID, internal::OrderKey>;
 
-/// @brief PriceLevel used by min/max heap.
-struct PriceLevel {
-    CentPrice                     price;
-    OrderListByPriceMap::iterator iterMap;
+/// StopOrder waits in a StopIndex until a trade reaches its stop price.
+struct StopOrder {
+    OrderID   orderID;
+    Side      side;
+    bool      isStopLimit; // released as a limit order at limitPrice, or as a market order.
+    Qty       qty;
+    CentPrice limitPrice;
+};
+
+inline bool isLowerPrice(CentPrice x, CentPrice y) { return x < y; }
+inline bool isHigherPrice(CentPrice x, CentPrice y) { return x > y; }
+
+/// StopIndex holds the stop orders of a side by stop price in trigger order: ascending for buy, descending for sell; FIFO at a price.
+using StopIndex = std::multimap<CentPrice, StopOrder, ComparePrice>;
+
+/// PendingOrder is a validated bulk loaded order. Its OrderKey is in the orderID map but not linked to a level yet.
+struct PendingOrder {
+    OrderID                        orderID;
+    Qty                            qty;
+    CentPrice                      price;
+    OrderKeyByOrderIDMap::iterator iterKey;
 };
 
 /// @brief SideBook maintains all orders by pricess for a side of an instrument.
+template<RiskStage RiskT>
 class SideBook {
-    OrderKeyByOrderIDMap             &_orderKeyByOrderIDMap; // shared OrderIDMap by buy&sell books of an instrument.
-    Side                              _side;
-    OrderListByPriceMap               _levelsByPriceMap;
-    std::vector<internal::PriceLevel> _priceQue; // Buy(0): max heap; Sell(1): min heap.
-    size_t                            _nOrders{0}, _nPriceLevels{0};
+    OrderKeyByOrderIDMap   &_orderKeyByOrderIDMap;  // shared OrderIDMap by buy&sell books of an instrument.
+    SessionIndex           &_sessions;              // shared; an order is unlinked from its session when its key is erased.
+    RiskT                  &_risk;                  // shared; its account hooks compile away unless it TracksAccounts.
+    Side                    _side;
+    PriceLevelMap           _levels;                // Buy(0): descending prices; Sell(1): ascending prices.
+    OrderListByPriceMap     _levelsByPriceMap;      // O(1) lookup of an existing level.
+    size_t                  _nOrders{0};
+    CentPrice               _lastTradePrice{};      // of the last fill on this side
+    CentPrice               _firstTradePrice{};     // of the first fill of the last match
+    SideBookStats           _stats;                 // counters; nOrders etc. are filled by getStats.
+    std::array<PegQueue, 2> _pegQueues;             // by PegType - 1
+    size_t                  _nPeggedOrders{};
 
-    bool (*compare_price)(const internal::PriceLevel &x, const internal::PriceLevel &y) = nullptr; // used by _priceQue
-    bool (*can_match)(internal::PriceLevel thisPrice, CentPrice otherPrice)             = nullptr;
+    bool (*can_match)(CentPrice thisPrice, CentPrice otherPrice) = nullptr;
 
-    static bool compare_price_buy(const internal::PriceLevel &x, const internal::PriceLevel &y) {
-        return x.price < y.price; // Buy: max heap
+    static bool compare_price_buy(CentPrice x, CentPrice y) {
+        return x > y; // Buy: higher price first
     }
-    static bool compare_price_sell(const internal::PriceLevel &x, const internal::PriceLevel &y) {
-        return x.price > y.price; // Sell: min heap
+    static bool compare_price_sell(CentPrice x, CentPrice y) {
+        return x < y; // Sell: lower price first
     }
-    static bool can_match_buy(internal::PriceLevel thisPrice, CentPrice otherPrice) {
-        return thisPrice.price >= otherPrice; // buy >= sell
+    static bool can_match_buy(CentPrice thisPrice, CentPrice otherPrice) {
+        return thisPrice >= otherPrice; // buy >= sell
     }
-    static bool can_match_sell(internal::PriceLevel thisPrice, CentPrice otherPrice) { return thisPrice.price <= otherPrice; }
+    static bool can_match_sell(CentPrice thisPrice, CentPrice otherPrice) { return thisPrice <= otherPrice; }
 
 
 public:
-    SideBook(std::unordered_map<OrderID, OrderKey> &orderKeyByOrderIDMap, Side side, size_t reserveOrders, size_t reservePriceLevelsPerSide)
-        : _orderKeyByOrderIDMap(orderKeyByOrderIDMap), _side(side) {
-        if (side == Side::Buy) {
-            compare_price = &compare_price_buy;
-            can_match     = &can_match_buy;
-        } else {
-            compare_price = &compare_price_sell;
-            can_match     = &can_match_sell;
-        }
+    SideBook(OrderKeyByOrderIDMap &orderKeyByOrderIDMap,
+             SessionIndex         &sessions,
+             RiskT                &risk,
+             Side                  side,
+             size_t                reserveOrders,
+             size_t                reservePriceLevelsPerSide)
+        : _orderKeyByOrderIDMap(orderKeyByOrderIDMap),
+          _sessions(sessions),
+          _risk(risk),
+          _side(side),
+          _levels(side == Side::Buy ? &compare_price_buy : &compare_price_sell) {
+        can_match = side == Side::Buy ? &can_match_buy : &can_match_sell;
         _levelsByPriceMap.reserve(reservePriceLevelsPerSide);
-        _priceQue.reserve(reservePriceLevelsPerSide);
     }
 
     /// Add order to book.
-    void addNewOrder(OrderID orderID, Qty qty, CentPrice price) {
-        //- use the hashmap to find the price level.
-        auto [iterMap, inserted] = _levelsByPriceMap.try_emplace(price);
-        if (inserted) // it's a new level. add to queue
-        {
-            _priceQue.push_back(PriceLevel{price, iterMap});
-            std::push_heap(_priceQue.begin(), _priceQue.end(), *compare_price);
-            ++_nPriceLevels;
-        }
+    /// @param displayQty  > 0 for an iceberg order: only displayQty of qty is in the level at a time.
+    void addNewOrder(OrderID orderID, Qty qty, CentPrice price, Qty displayQty, OwnerID ownerID, BookEventReporter auto &&reporter) {
+        auto [iterMap, isNewLevel] = findOrAddLevel(price);
+        PriceLevel &level          = iterMap->second;
         //- add order to orderlist
-        OrderList &orderList = iterMap->second;
-        orderList.push_back(OrderInfo{.orderID = orderID, .qty = qty, .price = price});
-        bool ok = _orderKeyByOrderIDMap.try_emplace(orderID, OrderKey{.side = _side, .iterList = --orderList.end(), .iterMap = iterMap}).second;
+        OrderInfo &orderInfo = level.orderList.emplace_back(OrderInfo{.orderID = orderID, .ownerID = ownerID, .displayQty = displayQty});
+        setLeavesQty(orderInfo, qty);
+        level.totalQty += orderInfo.qty;
+        bool ok =
+                _orderKeyByOrderIDMap.try_emplace(orderID, OrderKey{.side = _side, .iterList = --level.orderList.end(), .iterMap = iterMap}).second;
         assert(ok && "Logic Error: orderID has been checked before calling addNewOrder");
+        if constexpr (RiskT::TracksAccounts) _risk.onRest(ownerID, _side, qty);
         ++_nOrders;
+        ++_stats.nAdds;
+        _stats.maxOrdersPerLevel = std::max(_stats.maxOrdersPerLevel, level.orderList.size());
+        reportOrderEvent(reporter, OrderEventMsg::Add, orderID, orderID, price, orderInfo.qty, orderInfo.qty);
+        reportLevelUpdate(reporter, isNewLevel ? LevelUpdateMsg::New : LevelUpdateMsg::Change, iterMap);
     }
 
-    /// @return remaining qty after match
-    Qty tryMatchOtherSide(OrderID orderID, Qty qty, CentPrice price, BookEventReporter auto &&tradeReporter) {
-        while (qty && !_priceQue.empty() && (*can_match)(_priceQue.front(), price)) {
-            if (_priceQue.front().iterMap->second.empty()) {
-                removeTopEmptyPriceLevel();
-            } else {
-                internal::PriceLevel &thisLevel = _priceQue.front();
-                internal::OrderList  &orderList = thisLevel.iterMap->second;
-                internal::OrderInfo  &orderInfo = orderList.front();
-
-                Qty matchQty = std::min(qty, orderInfo.qty);
-                qty -= matchQty;
-                orderInfo.qty -= matchQty;
-
-                if (qty == 0) {
-                    // aggressiveOrder fully filled.
-                    if (orderInfo.qty == 0) {
-                        // restingOrder fully filled
-                        tradeReporter.onTrade(TradeMsg{.tradeQty            = matchQty,
-                                                       .tradePrice          = thisLevel.price,
-                                                       .aggressiveOrderFill = TradeMsg::Fill{.isFull = true, .orderID = orderID},
-                                                       .restingOrderFill    = TradeMsg::Fill{.isFull = true, .orderID = orderInfo.orderID}});
-                        removeOrderFromBookTop(orderList, orderInfo);
-                    } else {
-                        // restingOrder partially filled
-                        tradeReporter.onTrade(TradeMsg{
-                                .tradeQty            = matchQty,
-                                .tradePrice          = thisLevel.price,
-                                .aggressiveOrderFill = TradeMsg::Fill{.isFull = true, .orderID = orderID},
-                                .restingOrderFill    = TradeMsg::Fill{.isFull = false, .orderID = orderInfo.orderID, .leaveQty = orderInfo.qty}});
-                    }
-                } else {
-                    // aggressiveOrder partially fill, restingOrder fully fill
-                    tradeReporter.onTrade(TradeMsg{.tradeQty            = matchQty,
-                                                   .tradePrice          = thisLevel.price,
-                                                   .aggressiveOrderFill = TradeMsg::Fill{.isFull = false, .orderID = orderID, .leaveQty = qty},
-                                                   .restingOrderFill    = TradeMsg::Fill{.isFull = true, .orderID = orderInfo.orderID}});
-                    removeOrderFromBookTop(orderList, orderInfo);
-                }
+    /// Append pending orders to the back of their levels without matching. They're stable-sorted into priority order unless they already
+    /// are, so that a new level is inserted with the previous level as hint: amortized O(1) instead of O(log(N)).
+    void bulkAddOrders(std::vector<PendingOrder> &orders, BookEventReporter auto &&reporter) {
+        auto byPriority = [this](const PendingOrder &x, const PendingOrder &y) { return _levels.key_comp()(x.price, y.price); };
+        if (!std::is_sorted(orders.begin(), orders.end(), byPriority)) std::stable_sort(orders.begin(), orders.end(), byPriority);
+        auto hint = _levels.begin();
+        for (size_t i = 0; i < orders.size();) {
+            CentPrice price                = orders[i].price;
+            auto [iterIndex, isNewLevel] = _levelsByPriceMap.try_emplace(price);
+            if (isNewLevel) {
+                iterIndex->second = _levels.emplace_hint(hint, price, PriceLevel{});
+                ++_stats.nLevelsCreated;
+            }
+            auto        iterMap = iterIndex->second;
+            PriceLevel &level   = iterMap->second;
+            for (; i < orders.size() && orders[i].price == price; ++i) {
+                const PendingOrder &order = orders[i];
+                level.orderList.push_back(OrderInfo{.orderID = order.orderID, .qty = order.qty});
+                level.totalQty += order.qty;
+                order.iterKey->second.iterList = --level.orderList.end();
+                order.iterKey->second.iterMap  = iterMap;
+                reportOrderEvent(reporter, OrderEventMsg::Add, order.orderID, order.orderID, price, order.qty, order.qty);
+            }
+            _stats.maxOrdersPerLevel = std::max(_stats.maxOrdersPerLevel, level.orderList.size());
+            reportLevelUpdate(reporter, isNewLevel ? LevelUpdateMsg::New : LevelUpdateMsg::Change, iterMap);
+            hint = std::next(iterMap);
+        }
+        _nOrders += orders.size();
+        _stats.nAdds += orders.size();
+        _stats.maxPriceLevels = std::max(_stats.maxPriceLevels, _levels.size());
+    }
+
+    /// @param ownerID  resting orders of the same owner don't trade with the order; selfTrade tells what happens instead.
+    /// @param pegPrices  prices of this side's pegged orders, fixed for the match.
+    /// @return remaining qty after match, 0 if the rest of the order is cancelled to prevent a self trade.
+    Qty tryMatchOtherSide(OrderID                 orderID,
+                          Qty                     qty,
+                          CentPrice               price,
+                          OwnerID                 ownerID,
+                          SelfTrade               selfTrade,
+                          const PegPrices        &pegPrices,
+                          BookEventReporter auto &&tradeReporter) {
+        uint64_t nFills = _stats.nFills;
+        if (!_levels.empty()) _firstTradePrice = _levels.begin()->first;
+        if (_nPeggedOrders) [[unlikely]]
+            return tryMatchWithPegs(orderID, qty, price, ownerID, selfTrade, pegPrices, nFills, tradeReporter);
+        return matchLevels(orderID, qty, price, ownerID, selfTrade, nFills, tradeReporter);
+    }
+
+    /// Add a pegged order at the back of its PegQueue. It has no level; iterMap is end().
+    void addPeggedOrder(OrderID orderID, Qty qty, PegType peg, BookEventReporter auto &&) {
+        PegQueue  &pegQueue  = _pegQueues[int(peg) - 1];
+        OrderInfo &orderInfo = pegQueue.orderList.emplace_back(OrderInfo{.orderID = orderID, .qty = qty});
+        pegQueue.totalQty += orderInfo.qty;
+        OrderKey orderKey{.side = _side, .peg = peg, .iterList = --pegQueue.orderList.end(), .iterMap = _levels.end()};
+        bool     ok = _orderKeyByOrderIDMap.try_emplace(orderID, orderKey).second;
+        assert(ok && "Logic Error: orderID has been checked before calling addPeggedOrder");
+        ++_nPeggedOrders;
+        ++_stats.nAdds;
+    }
+
+    size_t countPeggedOrders() const { return _nPeggedOrders; }
+    bool   hasPeggedOrders() const { return _nPeggedOrders; }
+
+    /// Cancel all pegged orders.
+    /// @param eraseOrderIDs  false if the caller clears the whole orderID map.
+    void cancelPeggedOrders(bool eraseOrderIDs, MassCancelMsg &summary) {
+        for (PegQueue &pegQueue : _pegQueues) {
+            if (eraseOrderIDs)
+                for (const OrderInfo &orderInfo : pegQueue.orderList) eraseOrderKey(orderInfo.orderID);
+            pegQueue = PegQueue{};
+        }
+        summary.nOrders += _nPeggedOrders;
+        _stats.nCancels += _nPeggedOrders;
+        _nPeggedOrders = 0;
+    }
+
+    /// match the levels in priority order while they match price.
+    Qty matchLevels(OrderID                 orderID,
+                    Qty                     qty,
+                    CentPrice               price,
+                    OwnerID                 ownerID,
+                    SelfTrade               selfTrade,
+                    uint64_t                nFills,
+                    BookEventReporter auto &&tradeReporter) {
+        while (qty && !_levels.empty() && (*can_match)(_levels.begin()->first, price)) {
+            auto                 iterMap    = _levels.begin();
+            CentPrice            levelPrice = iterMap->first;
+            internal::PriceLevel &level     = iterMap->second;
+            internal::OrderInfo  &orderInfo = level.orderList.front();
+            if (orderInfo.ownerID == ownerID && ownerID) [[unlikely]] {
+                qty = preventSelfTrade(iterMap, orderInfo, orderID, qty, selfTrade, tradeReporter);
+                if (_stats.nFills == nFills && !_levels.empty()) _firstTradePrice = _levels.begin()->first; // no trade yet
+                continue;
             }
+
+            Qty matchQty = std::min(qty, orderInfo.qty);
+            qty -= matchQty;
+            orderInfo.qty -= matchQty;
+            level.totalQty -= matchQty;
+            _lastTradePrice = levelPrice;
+            ++_stats.nFills;
+            reportAccountFill(ownerID, orderInfo.ownerID, matchQty);
+            reportOrderEvent(tradeReporter, OrderEventMsg::Execute, orderInfo.orderID, orderInfo.orderID, levelPrice, matchQty, orderInfo.qty);
+
+            Qty restingLeaveQty = orderInfo.qty + orderInfo.hiddenQty; // an iceberg order has its reserve left.
+            tradeReporter.onTrade(TradeMsg{.tradeQty            = matchQty,
+                                           .tradePrice          = levelPrice,
+                                           .aggressiveOrderFill = TradeMsg::Fill{.isFull = qty == 0, .orderID = orderID, .leaveQty = qty},
+                                           .restingOrderFill    = TradeMsg::Fill{
+                                                      .isFull = restingLeaveQty == 0, .orderID = orderInfo.orderID, .leaveQty = restingLeaveQty}});
+            if (orderInfo.qty) reportLevelUpdate(tradeReporter, LevelUpdateMsg::Change, iterMap); // aggressiveOrder fully filled.
+            else if (restingLeaveQty) refreshIcebergAtTop(iterMap, orderInfo, tradeReporter);
+            else removeOrderFromBookTop(iterMap, orderInfo, tradeReporter);
         }
 
         return qty;
     }
 
-    void cancelOrder(OrderKeyByOrderIDMap::iterator iterKey) {
-        OrderList &orderList = iterKey->second.iterMap->second;
-        orderList.erase(iterKey->second.iterList);
-        _orderKeyByOrderIDMap.erase(iterKey);
+    void cancelOrder(OrderKeyByOrderIDMap::iterator iterKey, BookEventReporter auto &&reporter) {
+        if (iterKey->second.peg != PegType::None) [[unlikely]] { // not displayed, no market data.
+            PegQueue &pegQueue = _pegQueues[int(iterKey->second.peg) - 1];
+            auto      iterList = iterKey->second.iterList;
+            pegQueue.totalQty -= iterList->qty;
+            eraseOrderKey(iterKey);
+            pegQueue.orderList.erase(iterList);
+            --_nPeggedOrders;
+            ++_stats.nCancels;
+            return;
+        }
+        auto        iterMap   = iterKey->second.iterMap;
+        PriceLevel &level     = iterMap->second;
+        auto        iterList  = iterKey->second.iterList;
+        OrderInfo   orderInfo = *iterList;
+        level.totalQty -= orderInfo.qty;
+        eraseOrderKey(iterKey);
+        level.orderList.erase(iterList);
         --_nOrders;
-        if (orderList.empty()) {
-            --_nPriceLevels;
-            while (!_priceQue.empty() && _priceQue.front().iterMap->second.empty()) { removeTopEmptyPriceLevel(); }
-            // if it's not the top level, leave the empty level in book.
+        ++_stats.nCancels;
+        reportOrderEvent(reporter, OrderEventMsg::Cancel, orderInfo.orderID, orderInfo.orderID, iterMap->first, orderInfo.qty, 0);
+        if (level.orderList.empty()) removeLevel(iterMap, reporter);
+        else reportLevelUpdate(reporter, LevelUpdateMsg::Change, iterMap);
+    }
+
+    /// Cancel all orders with a price in [lo, hi] and remove their levels with one erase, which frees the orders in bulk.
+    /// @param eraseOrderIDs  false if the caller clears the whole orderID map.
+    /// @param summary  nOrders and nLevels are incremented.
+    void cancelLevels(
+            CentPrice lo, CentPrice hi, CancelReport report, bool eraseOrderIDs, MassCancelMsg &summary, BookEventReporter auto &&reporter) {
+        if (hi < lo) return;
+        bool   isBuy   = _side == Side::Buy;
+        auto   first   = _levels.lower_bound(isBuy ? hi : lo), last = _levels.upper_bound(isBuy ? lo : hi);
+        size_t nOrders = 0, nLevels = 0;
+        for (auto iterMap = first; iterMap != last; ++iterMap, ++nLevels) {
+            for (const OrderInfo &orderInfo : iterMap->second.orderList) {
+                if (eraseOrderIDs) eraseOrderKey(orderInfo.orderID);
+                if (report == CancelReport::PerOrder)
+                    reportOrderEvent(reporter, OrderEventMsg::Cancel, orderInfo.orderID, orderInfo.orderID, iterMap->first, orderInfo.qty, 0);
+            }
+            nOrders += iterMap->second.orderList.size();
+            if (report == CancelReport::PerOrder) reportLevelUpdate(reporter, LevelUpdateMsg::Delete, iterMap);
         }
+        if (first == _levels.begin() && last == _levels.end()) {
+            _levelsByPriceMap.clear();
+            _levels.clear();
+        } else {
+            for (auto iterMap = first; iterMap != last; ++iterMap) _levelsByPriceMap.erase(iterMap->first);
+            _levels.erase(first, last);
+        }
+        _nOrders -= nOrders;
+        _stats.nCancels += nOrders;
+        _stats.nLevelsDestroyed += nLevels;
+        summary.nOrders += nOrders;
+        summary.nLevels += nLevels;
+    }
+
+    /// Change qty of an order at the same price. Reducing qty keeps priority; increasing qty moves it to the back of the level.
+    /// @param origOrderID  orderID before the caller rekeyed the order, for the Modify event.
+    /// An iceberg order's reserve is reduced before its displayed qty.
+    void amendOrderQty(OrderKeyByOrderIDMap::iterator iterKey, Qty newQty, OrderID origOrderID, BookEventReporter auto &&reporter) {
+        OrderKey   &orderKey  = iterKey->second;
+        PriceLevel &level     = orderKey.iterMap->second;
+        OrderInfo  &orderInfo = *orderKey.iterList;
+        Qty         oldQty    = orderInfo.qty, oldLeavesQty = orderInfo.qty + orderInfo.hiddenQty;
+        if (newQty > oldLeavesQty) { // relink to the back, iterList stays valid.
+            level.orderList.splice(level.orderList.end(), level.orderList, orderKey.iterList);
+            setLeavesQty(orderInfo, newQty);
+        } else {
+            orderInfo.qty       = std::min(orderInfo.qty, newQty);
+            orderInfo.hiddenQty = newQty - orderInfo.qty;
+        }
+        level.totalQty += orderInfo.qty - oldQty;
+        reportAccountResize(orderInfo, oldLeavesQty);
+        reportOrderEvent(reporter, OrderEventMsg::Modify, iterKey->first, origOrderID, orderKey.iterMap->first, orderInfo.qty, orderInfo.qty);
+        reportLevelUpdate(reporter, LevelUpdateMsg::Change, orderKey.iterMap);
+    }
+
+    /// Move an order to the back of another price level. The list node is relinked, not reallocated.
+    /// @param origOrderID  orderID before the caller rekeyed the order, for the Modify event.
+    void moveOrderToPrice(
+            OrderKeyByOrderIDMap::iterator iterKey, Qty newQty, CentPrice newPrice, OrderID origOrderID, BookEventReporter auto &&reporter) {
+        OrderKey &orderKey         = iterKey->second;
+        auto      iterOldMap       = orderKey.iterMap;
+        auto [iterMap, isNewLevel] = findOrAddLevel(newPrice);
+        PriceLevel &newLevel = iterMap->second, &oldLevel = iterOldMap->second;
+        OrderInfo &orderInfo    = *orderKey.iterList;
+        Qty        oldLeavesQty = orderInfo.qty + orderInfo.hiddenQty;
+        oldLevel.totalQty -= orderInfo.qty;
+        setLeavesQty(orderInfo, newQty);
+        newLevel.totalQty += orderInfo.qty;
+        reportAccountResize(orderInfo, oldLeavesQty);
+        newLevel.orderList.splice(newLevel.orderList.end(), oldLevel.orderList, orderKey.iterList);
+        orderKey.iterMap         = iterMap;
+        _stats.maxOrdersPerLevel = std::max(_stats.maxOrdersPerLevel, newLevel.orderList.size());
+        reportOrderEvent(reporter, OrderEventMsg::Modify, iterKey->first, origOrderID, newPrice, orderInfo.qty, orderInfo.qty);
+        if (oldLevel.orderList.empty()) removeLevel(iterOldMap, reporter);
+        else reportLevelUpdate(reporter, LevelUpdateMsg::Change, iterOldMap);
+        reportLevelUpdate(reporter, isNewLevel ? LevelUpdateMsg::New : LevelUpdateMsg::Change, iterMap);
+    }
+
+    /// Copy levels in priority order and their orders in time priority.
+    void takeSnapshot(std::vector<SnapshotLevel> &levels, std::vector<OrderInfo> &orders) const {
+        levels.clear();
+        orders.clear();
+        orders.reserve(_nOrders);
+        for (const auto &[price, level] : _levels) {
+            levels.push_back(SnapshotLevel{.price = price, .nOrders = uint32_t(level.orderList.size())});
+            orders.insert(orders.end(), level.orderList.begin(), level.orderList.end());
+        }
+    }
+
+    /// Build levels and the orderID index from a snapshot in one pass, without matching. The side must be empty.
+    /// Levels are appended at the end of the level map, amortized O(1) each.
+    /// @return false if the snapshot is inconsistent.
+    bool restoreSnapshot(const std::vector<SnapshotLevel> &levels, const std::vector<OrderInfo> &orders) {
+        assert(_nOrders == 0 && _levels.empty());
+        _levelsByPriceMap.reserve(levels.size());
+        auto iterOrder = orders.begin();
+        for (const SnapshotLevel &level : levels) {
+            if (level.nOrders == 0 || size_t(orders.end() - iterOrder) < level.nOrders) return false;
+            if (!_levels.empty() && !_levels.key_comp()(_levels.rbegin()->first, level.price)) return false; // not in priority order
+            auto        iterMap    = _levels.emplace_hint(_levels.end(), level.price, PriceLevel{});
+            PriceLevel &priceLevel = iterMap->second;
+            _levelsByPriceMap.emplace(level.price, iterMap);
+            for (auto iterEnd = iterOrder + level.nOrders; iterOrder != iterEnd; ++iterOrder) {
+                priceLevel.orderList.push_back(*iterOrder);
+                priceLevel.totalQty += iterOrder->qty;
+                _orderKeyByOrderIDMap.try_emplace(iterOrder->orderID,
+                                                  OrderKey{.side = _side, .iterList = --priceLevel.orderList.end(), .iterMap = iterMap});
+                if constexpr (RiskT::TracksAccounts) _risk.onRest(iterOrder->ownerID, _side, iterOrder->qty + iterOrder->hiddenQty);
+            }
+            _nOrders += level.nOrders;
+            _stats.maxOrdersPerLevel = std::max<size_t>(_stats.maxOrdersPerLevel, level.nOrders);
+        }
+        _stats.nLevelsCreated += levels.size();
+        _stats.maxPriceLevels = std::max(_stats.maxPriceLevels, _levels.size());
+        return iterOrder == orders.end();
+    }
+
+    /// Copy up to nLevels aggregated levels in priority order. O(nLevels).
+    /// @return number of levels copied.
+    size_t depth(size_t nLevels, std::span<DepthLevel> output) const {
+        size_t n    = std::min({nLevels, output.size(), _levels.size()});
+        auto   iter = _levels.begin();
+        for (size_t i = 0; i < n; ++i, ++iter) output[i] = toDepthLevel(*iter);
+        return n;
+    }
+    DepthLevel top() const { return _levels.empty() ? DepthLevel{} : toDepthLevel(*_levels.begin()); }
+
+    /// @return true if the orders that match price have at least qty in total. O(levels walked) with the level aggregates; if they fall
+    /// short, the orders of those levels are walked to add the iceberg reserves, which the matcher fills at their level.
+    /// With an owner, see canFillWithOwner.
+    bool canFill(Qty qty, CentPrice price, const PegPrices &pegPrices, OwnerID ownerID = 0, SelfTrade selfTrade = SelfTrade::CancelResting) const {
+        if (ownerID) return canFillWithOwner(qty, price, pegPrices, ownerID, selfTrade);
+        int64_t matchableQty = 0;
+        for (size_t i = 0; i < _pegQueues.size() && _nPeggedOrders; ++i)
+            if (pegPrices[i] && (*can_match)(*pegPrices[i], price)) matchableQty += _pegQueues[i].totalQty;
+        auto last = _levels.begin();
+        for (; last != _levels.end() && (*can_match)(last->first, price); ++last)
+            if ((matchableQty += last->second.totalQty) >= qty) return true;
+        for (auto iterMap = _levels.begin(); iterMap != last; ++iterMap)
+            for (const OrderInfo &orderInfo : iterMap->second.orderList)
+                if ((matchableQty += orderInfo.hiddenQty) >= qty) return true;
+        return matchableQty >= qty;
+    }
+
+    /// canFill without the orders of the owner, which self-trade prevention cancels instead of trading. The orders are walked in
+    /// priority order: CancelResting skips them; the other modes cancel or decrement the aggressive order, so only what's before the
+    /// first one counts. At its level, that's the displayed qty: the iceberg refreshes go behind it.
+    bool canFillWithOwner(Qty qty, CentPrice price, const PegPrices &pegPrices, OwnerID ownerID, SelfTrade selfTrade) const {
+        int64_t                  matchableQty = 0;
+        std::optional<CentPrice> stopPrice; // of the first order of the owner, unless CancelResting
+        for (auto iterMap = _levels.begin(); iterMap != _levels.end() && (*can_match)(iterMap->first, price) && !stopPrice; ++iterMap) {
+            int64_t hiddenQty = 0;
+            for (const OrderInfo &orderInfo : iterMap->second.orderList) {
+                if (orderInfo.ownerID != ownerID) {
+                    if ((matchableQty += orderInfo.qty) >= qty) return true;
+                    hiddenQty += orderInfo.hiddenQty;
+                } else if (selfTrade != SelfTrade::CancelResting) {
+                    stopPrice = iterMap->first;
+                    break;
+                }
+            }
+            if (!stopPrice) matchableQty += hiddenQty;
+        }
+        // pegged orders have no owner; they match after the levels at the same price.
+        for (size_t i = 0; i < _pegQueues.size() && _nPeggedOrders; ++i)
+            if (pegPrices[i] && (*can_match)(*pegPrices[i], price) && (!stopPrice || isBetterPrice(*pegPrices[i], *stopPrice)))
+                matchableQty += _pegQueues[i].totalQty;
+        return matchableQty >= qty;
+    }
+
+    CentPrice lastTradePrice() const { return _lastTradePrice; }
+
+    /// @return true if price x has priority over price y on this side.
+    bool isBetterPrice(CentPrice x, CentPrice y) const { return _levels.key_comp()(x, y); }
+    /// @return true if an order at otherPrice on the other side matches thisPrice on this side.
+    bool canMatch(CentPrice thisPrice, CentPrice otherPrice) const { return (*can_match)(thisPrice, otherPrice); }
+
+    /// price of the first trade of the last tryMatchOtherSide if it traded.
+    CentPrice firstTradePrice() const { return _firstTradePrice; }
+    uint64_t  countFills() const { return _stats.nFills; }
+
+    const SideBookStats &getStats() {
+        _stats.nOrders      = _nOrders;
+        _stats.nPriceLevels = _levels.size();
+        return _stats;
     }
 
     size_t countOrders() const { return _nOrders; }
-    size_t countPriceLevels() const { return _nPriceLevels; }
-    /// PriceQueueSize >= PriceLevels. There may be empty price levels in queue.
-    size_t getPriceQueueSize() const { return _priceQue.size(); }
+    size_t countPriceLevels() const { return _levels.size(); }
     size_t countOrdersAtPrice(CentPrice price) const {
-        if (auto it = _levelsByPriceMap.find(price); it != _levelsByPriceMap.end()) return it->second.size();
+        if (auto it = _levelsByPriceMap.find(price); it != _levelsByPriceMap.end()) return it->second->second.orderList.size();
         return 0;
     }
 
 private:
-    void removeTopEmptyPriceLevel() {
-        assert(!_priceQue.empty());
-        _levelsByPriceMap.erase(_priceQue.front().iterMap);
-        std::pop_heap(_priceQue.begin(), _priceQue.end(), *compare_price);
-        _priceQue.pop_back();
+    static DepthLevel toDepthLevel(const PriceLevelMap::value_type &level) {
+        return DepthLevel{.price = level.first, .totalQty = level.second.totalQty, .nOrders = uint32_t(level.second.orderList.size())};
+    }
+
+    /// O(1) if the level exists, else O(log(N)) to insert it into the level map.
+    /// @return the level and whether it's new.
+    std::pair<PriceLevelMap::iterator, bool> findOrAddLevel(CentPrice price) {
+        auto [iterIndex, inserted] = _levelsByPriceMap.try_emplace(price);
+        if (inserted) { // it's a new level.
+            iterIndex->second = _levels.try_emplace(price).first;
+            ++_stats.nLevelsCreated;
+            _stats.maxPriceLevels = std::max(_stats.maxPriceLevels, _levels.size());
+        }
+        return {iterIndex->second, inserted};
+    }
+
+    /// remove an empty level. Amortized O(1).
+    void removeLevel(PriceLevelMap::iterator iterMap, BookEventReporter auto &&reporter) {
+        assert(iterMap->second.orderList.empty());
+        reportLevelUpdate(reporter, LevelUpdateMsg::Delete, iterMap);
+        _levelsByPriceMap.erase(iterMap->first);
+        _levels.erase(iterMap);
+        ++_stats.nLevelsDestroyed;
+    }
+
+    /// Split leaves qty into the displayed qty and the hidden reserve of an iceberg order; all of it is displayed otherwise.
+    static void setLeavesQty(OrderInfo &orderInfo, Qty leavesQty) {
+        orderInfo.qty       = orderInfo.displayQty ? std::min(orderInfo.displayQty, leavesQty) : leavesQty;
+        orderInfo.hiddenQty = leavesQty - orderInfo.qty;
+    }
+
+    /// Display the next part of an iceberg order whose displayed qty is filled and move it to the back of its level. The list node is
+    /// relinked, so its OrderKey stays valid. It's reported as a new order at the back of the level.
+    void refreshIcebergAtTop(PriceLevelMap::iterator iterMap, internal::OrderInfo &orderInfo, BookEventReporter auto &&reporter) {
+        PriceLevel &level = iterMap->second;
+        setLeavesQty(orderInfo, orderInfo.hiddenQty);
+        level.totalQty += orderInfo.qty;
+        level.orderList.splice(level.orderList.end(), level.orderList, level.orderList.begin());
+        reportOrderEvent(reporter, OrderEventMsg::Add, orderInfo.orderID, orderInfo.orderID, iterMap->first, orderInfo.qty, orderInfo.qty);
+        reportLevelUpdate(reporter, LevelUpdateMsg::Change, iterMap);
+    }
+
+    /// @return the qty cancelled from the aggressive and the resting order to prevent a self trade, reported to a SelfTradeReporter.
+    static SelfTradeMsg selfTradeCancels(
+            SelfTrade selfTrade, OrderID orderID, Qty qty, const OrderInfo &orderInfo, BookEventReporter auto &&reporter) {
+        Qty          restingQty = orderInfo.qty + orderInfo.hiddenQty;
+        Qty          minQty     = std::min(qty, orderInfo.qty);
+        SelfTradeMsg msg{.mode                = selfTrade,
+                         .aggressiveOrderID   = orderID,
+                         .restingOrderID      = orderInfo.orderID,
+                         .aggressiveCancelQty = 0,
+                         .restingCancelQty    = 0};
+        switch (selfTrade) {
+            case SelfTrade::CancelResting: msg.restingCancelQty = restingQty; break;
+            case SelfTrade::CancelAggressive: msg.aggressiveCancelQty = qty; break;
+            case SelfTrade::CancelBoth: msg.aggressiveCancelQty = qty, msg.restingCancelQty = restingQty; break;
+            case SelfTrade::Decrement: msg.aggressiveCancelQty = minQty, msg.restingCancelQty = minQty; break;
+        }
+        if constexpr (SelfTradeReporter<decltype(reporter)>) reporter.onSelfTrade(msg);
+        return msg;
+    }
+
+    /// Cancel or decrement the top order and/or the aggressive order, which have the same owner, instead of trading.
+    /// @return aggressive qty left.
+    Qty preventSelfTrade(PriceLevelMap::iterator iterMap,
+                         internal::OrderInfo    &orderInfo,
+                         OrderID                 orderID,
+                         Qty                     qty,
+                         SelfTrade               selfTrade,
+                         BookEventReporter auto &&reporter) {
+        PriceLevel  &level = iterMap->second;
+        SelfTradeMsg msg   = selfTradeCancels(selfTrade, orderID, qty, orderInfo, reporter);
+        if (!msg.restingCancelQty) return qty - msg.aggressiveCancelQty;
+        if (msg.restingCancelQty < orderInfo.qty + orderInfo.hiddenQty) { // Decrement: the displayed qty is reduced like a fill.
+            orderInfo.qty -= msg.restingCancelQty;
+            level.totalQty -= msg.restingCancelQty;
+            if constexpr (RiskT::TracksAccounts) _risk.onResize(orderInfo.ownerID, _side, -msg.restingCancelQty);
+            reportOrderEvent(reporter, OrderEventMsg::Modify, orderInfo.orderID, orderInfo.orderID, iterMap->first, orderInfo.qty, orderInfo.qty);
+            if (orderInfo.qty) reportLevelUpdate(reporter, LevelUpdateMsg::Change, iterMap);
+            else refreshIcebergAtTop(iterMap, orderInfo, reporter);
+            return qty - msg.aggressiveCancelQty;
+        }
+        level.totalQty -= orderInfo.qty;
+        ++_stats.nCancels;
+        reportOrderEvent(reporter, OrderEventMsg::Cancel, orderInfo.orderID, orderInfo.orderID, iterMap->first, orderInfo.qty, 0);
+        removeOrderFromBookTop(iterMap, orderInfo, reporter);
+        return qty - msg.aggressiveCancelQty;
+    }
+
+    /// Match the levels and the pegged orders by price. At the same price, the levels come first, then Primary, then Midpoint.
+    Qty tryMatchWithPegs(OrderID                 orderID,
+                         Qty                     qty,
+                         CentPrice               price,
+                         OwnerID                 ownerID,
+                         SelfTrade               selfTrade,
+                         const PegPrices        &pegPrices,
+                         uint64_t                nFills,
+                         BookEventReporter auto &&tradeReporter) {
+        while (qty) {
+            PegQueue *pegQueue = nullptr;
+            CentPrice pegPrice{};
+            for (size_t i = 0; i < _pegQueues.size(); ++i) {
+                if (_pegQueues[i].orderList.empty() || !pegPrices[i] || !(*can_match)(*pegPrices[i], price)) continue;
+                if (!pegQueue || isBetterPrice(*pegPrices[i], pegPrice)) pegQueue = &_pegQueues[i], pegPrice = *pegPrices[i];
+            }
+            if (!pegQueue) return matchLevels(orderID, qty, price, ownerID, selfTrade, nFills, tradeReporter);
+            if (!_levels.empty() && !isBetterPrice(pegPrice, _levels.begin()->first)) { // levels at pegPrice or better first
+                qty = matchLevels(orderID, qty, pegPrice, ownerID, selfTrade, nFills, tradeReporter);
+                continue;
+            }
+            if (_stats.nFills == nFills) _firstTradePrice = pegPrice;
+            qty = matchPeggedOrder(*pegQueue, pegPrice, orderID, qty, ownerID, tradeReporter);
+        }
+        return qty;
+    }
+
+    /// Fill the first order of a PegQueue at pegPrice. Pegged orders have no owner, so there's no self trade to prevent.
+    /// @return aggressive qty left.
+    Qty matchPeggedOrder(
+            PegQueue &pegQueue, CentPrice pegPrice, OrderID orderID, Qty qty, OwnerID ownerID, BookEventReporter auto &&tradeReporter) {
+        OrderInfo &orderInfo = pegQueue.orderList.front();
+        Qty        matchQty  = std::min(qty, orderInfo.qty);
+        qty -= matchQty;
+        orderInfo.qty -= matchQty;
+        pegQueue.totalQty -= matchQty;
+        _lastTradePrice = pegPrice;
+        ++_stats.nFills;
+        reportAccountFill(ownerID, orderInfo.ownerID, matchQty);
+        tradeReporter.onTrade(TradeMsg{.tradeQty            = matchQty,
+                                       .tradePrice          = pegPrice,
+                                       .aggressiveOrderFill = TradeMsg::Fill{.isFull = qty == 0, .orderID = orderID, .leaveQty = qty},
+                                       .restingOrderFill    = TradeMsg::Fill{
+                                                  .isFull = orderInfo.qty == 0, .orderID = orderInfo.orderID, .leaveQty = orderInfo.qty}});
+        if (!orderInfo.qty) removePeggedOrderFromTop(pegQueue);
+        return qty;
+    }
+
+    void removePeggedOrderFromTop(PegQueue &pegQueue) {
+        eraseOrderKey(pegQueue.orderList.front().orderID);
+        pegQueue.orderList.pop_front();
+        --_nPeggedOrders;
     }
 
-    void removeOrderFromBookTop(internal::OrderList &orderList, internal::OrderInfo &orderInfo) {
-        _orderKeyByOrderIDMap.erase(orderInfo.orderID);
-        orderList.pop_front();
+    /// erase the key of an order leaving the book and unlink it from its session. Its OrderInfo isn't erased yet.
+    void eraseOrderKey(OrderKeyByOrderIDMap::iterator iterKey) {
+        if (iterKey->second.inSession) [[unlikely]] _sessions.remove(iterKey->first);
+        if constexpr (RiskT::TracksAccounts) {
+            const OrderInfo &orderInfo = *iterKey->second.iterList;
+            _risk.onRemove(orderInfo.ownerID, _side, orderInfo.qty + orderInfo.hiddenQty);
+        }
+        _orderKeyByOrderIDMap.erase(iterKey);
+    }
+    void eraseOrderKey(OrderID orderID) { eraseOrderKey(_orderKeyByOrderIDMap.find(orderID)); }
+
+    void removeOrderFromBookTop(PriceLevelMap::iterator iterMap, internal::OrderInfo &orderInfo, BookEventReporter auto &&reporter) {
+        eraseOrderKey(orderInfo.orderID);
+        iterMap->second.orderList.pop_front();
         --_nOrders;
-        if (orderList.empty()) {
-            --_nPriceLevels;
-            removeTopEmptyPriceLevel();
+        if (iterMap->second.orderList.empty()) removeLevel(iterMap, reporter);
+        else reportLevelUpdate(reporter, LevelUpdateMsg::Change, iterMap);
+    }
+
+    /// account positions of a fill, compiled away unless the risk stage TracksAccounts.
+    void reportAccountFill(OwnerID aggressiveOwnerID, OwnerID restingOwnerID, Qty qty) {
+        if constexpr (RiskT::TracksAccounts) {
+            _risk.onFill(aggressiveOwnerID, _side == Side::Buy ? Side::Sell : Side::Buy, qty);
+            _risk.onFill(restingOwnerID, _side, qty);
+            _risk.onResize(restingOwnerID, _side, -qty);
+        }
+    }
+
+    /// open qty of an account when a resting order is amended or decremented, compiled away unless the risk stage TracksAccounts.
+    void reportAccountResize(const OrderInfo &orderInfo, Qty oldLeavesQty) {
+        if constexpr (RiskT::TracksAccounts) _risk.onResize(orderInfo.ownerID, _side, orderInfo.qty + orderInfo.hiddenQty - oldLeavesQty);
+    }
+
+    /// market data events compile away unless the reporter is a MarketDataReporter.
+    template<class ReporterT>
+    void reportLevelUpdate(ReporterT &reporter, LevelUpdateMsg::Type type, PriceLevelMap::iterator iterMap) const {
+        if constexpr (MarketDataReporter<ReporterT>) {
+            bool isDelete = type == LevelUpdateMsg::Delete;
+            reporter.onLevelUpdate(LevelUpdateMsg{.type     = type,
+                                                  .side     = _side,
+                                                  .price    = iterMap->first,
+                                                  .totalQty = isDelete ? 0 : iterMap->second.totalQty,
+                                                  .nOrders  = isDelete ? 0 : uint32_t(iterMap->second.orderList.size())});
+        }
+    }
+    template<class ReporterT>
+    void reportOrderEvent(
+            ReporterT &reporter, OrderEventMsg::Type type, OrderID orderID, OrderID origOrderID, CentPrice price, Qty qty, Qty leaveQty) const {
+        if constexpr (MarketDataReporter<ReporterT>) {
+            reporter.onOrderEvent(OrderEventMsg{.type        = type,
+                                                .side        = _side,
+                                                .orderID     = orderID,
+                                                .origOrderID = origOrderID,
+                                                .price       = price,
+                                                .qty         = qty,
+                                                .leaveQty    = leaveQty});
         }
     }
 };
 } // namespace internal
 
 
+/// BookSnapshot is the resting state of an OrderBook: for each side, non-empty levels in priority order,
+/// and orders of all levels in the same order, each level in time priority.
+struct BookSnapshot {
+    uint64_t                                            journalSeq{}; // set by caller: seq of the last journaled request applied.
+    std::array<std::vector<internal::SnapshotLevel>, 2> levels;       // buy & sell
+    std::array<std::vector<internal::OrderInfo>, 2>     orders;       // buy & sell
+};
+
+/// BookStats is a snapshot of the counters and shape of a book, including the orderID hash map.
+struct BookStats {
+    std::array<SideBookStats, 2> sides; // buy & sell
+    size_t                       nOrderIDs{}, nOrderIDBuckets{};
+    double                       orderIDLoadFactor{};
+    double                       orderIDMeanProbeLength{}; // mean bucket chain length walked by a successful lookup
+    size_t                       orderIDMaxProbeLength{};  // longest bucket chain
+};
+
 /// @brief OrderBook manages all orders for an instrument.
-template<BookEventReporter BookEventReporterT>
+template<BookEventReporter BookEventReporterT, RiskStage RiskT = NoRiskChecks>
 class OrderBook {
-    BookEventReporterT               &_eventReporter;
-    internal::OrderKeyByOrderIDMap    _orderKeyByOrderIDMap; // elements are added/deleted in internal::Book.
-    std::array<internal::SideBook, 2> _books;                // buy & sell books
+    static constexpr CentPrice MinPrice = std::numeric_limits<CentPrice>::min(), MaxPrice = std::numeric_limits<CentPrice>::max();
+
+    BookEventReporterT                      &_eventReporter;
+    internal::OrderKeyByOrderIDMap           _orderKeyByOrderIDMap; // elements are added/deleted in internal::Book.
+    internal::SessionIndex                   _sessions;             // orders of gateway sessions, unlinked in internal::Book.
+    RiskT                                    _risk;                 // pre-trade risk stage
+    std::array<internal::SideBook<RiskT>, 2> _books;                // buy & sell books
+    TopOfBook                                _publishedBBO;         // last BBO reported to a BBOReporter
+    int                                      _batchDepth{};
+    std::array<std::vector<internal::PendingOrder>, 2> _pendingOrders; // scratch for bulkLoad
+    // stop orders, not in snapshots.
+    std::array<internal::StopIndex, 2>                         _stops; // buy & sell
+    std::unordered_map<OrderID, internal::StopIndex::iterator> _stopByOrderID;
+    std::vector<internal::StopOrder>                           _triggeredStops; // FIFO of released stop orders
+    CentPrice                                                  _lastTradePrice{};
+    CentPrice _minTradePrice = MaxPrice, _maxTradePrice = MinPrice; // range of trade prices not checked against stop prices yet
+    bool      _hasTraded{}, _releasingStops{};
+    // good-till-time orders, not in snapshots. The timer of an order that fills or is mass cancelled is dropped when it fires.
+    internal::ExpiryWheel _expiries;
+
 public:
+    static constexpr CentPrice NoPriceProtection = -1; // matchMarketOrder sweeps the other side without limit.
+
     explicit OrderBook(BookEventReporterT &reporter, size_t reserveOrders = 100000, size_t reservePriceLevelsPerSide = 1000)
         : _eventReporter(reporter),
-          _books{internal::SideBook{_orderKeyByOrderIDMap, Side::Buy, reserveOrders, reservePriceLevelsPerSide},
-                 internal::SideBook{_orderKeyByOrderIDMap, Side::Sell, reserveOrders, reservePriceLevelsPerSide}} {}
+          _books{internal::SideBook<RiskT>{_orderKeyByOrderIDMap, _sessions, _risk, Side::Buy, reserveOrders, reservePriceLevelsPerSide},
+                 internal::SideBook<RiskT>{_orderKeyByOrderIDMap, _sessions, _risk, Side::Sell, reserveOrders, reservePriceLevelsPerSide}},
+          _stops{internal::StopIndex{&internal::isLowerPrice}, internal::StopIndex{&internal::isHigherPrice}} {}
 
     /// try matching the new order. If there's remaining qty, add to order book.
     /// @param tradeReporter  reports trade events and executions if there are matches.
     /// @return false when duplicate orderID
-    bool matchAddNewOrder(OrderID orderID, Side side, Qty qty, CentPrice price) {
-        if (_orderKeyByOrderIDMap.contains(orderID)) {
+    bool matchAddNewOrder(OrderID orderID, Side side, Qty qty, CentPrice price, TimeInForce timeInForce = TimeInForce::GTC) {
+        JZ_LATENCY_SCOPE(MsgType::AddOrderRequest);
+        return matchAddNewOrderImpl(orderID, side, qty, price, timeInForce, 0);
+    }
+
+    /// Add an order of an owner, e.g. an account. It doesn't trade with resting orders of the same owner: selfTrade tells what happens
+    /// instead, reported in a SelfTradeMsg to a SelfTradeReporter. The owner is kept while the order rests; an amend that crosses the
+    /// book cancels the resting orders of the same owner.
+    /// @return false when duplicate orderID
+    bool matchAddOwnerOrder(OrderID     orderID,
+                            Side        side,
+                            Qty         qty,
+                            CentPrice   price,
+                            OwnerID     ownerID,
+                            SelfTrade   selfTrade   = SelfTrade::CancelResting,
+                            TimeInForce timeInForce = TimeInForce::GTC) {
+        JZ_LATENCY_SCOPE(MsgType::AddOrderRequest);
+        return matchAddNewOrderImpl(orderID, side, qty, price, timeInForce, 0, ownerID, selfTrade);
+    }
+
+    /// Add an order of a gateway session: while it rests, it's linked into the session's list so that cancelSession finds it.
+    /// ownerID and selfTrade are as in matchAddOwnerOrder.
+    /// @return false when duplicate orderID or sessionID > SessionIndex::MaxSessionID.
+    bool matchAddSessionOrder(OrderID     orderID,
+                              Side        side,
+                              Qty         qty,
+                              CentPrice   price,
+                              SessionID   sessionID,
+                              OwnerID     ownerID     = 0,
+                              SelfTrade   selfTrade   = SelfTrade::CancelResting,
+                              TimeInForce timeInForce = TimeInForce::GTC) {
+        JZ_LATENCY_SCOPE(MsgType::AddOrderRequest);
+        if (sessionID > internal::SessionIndex::MaxSessionID) {
+            _eventReporter.onError(orderID, MsgType::AddOrderRequest, ErrCode::InvalidSession, "");
+            return false;
+        }
+        if (!matchAddNewOrderImpl(orderID, side, qty, price, timeInForce, 0, ownerID, selfTrade)) return false;
+        if (auto it = _orderKeyByOrderIDMap.find(orderID); it != _orderKeyByOrderIDMap.end()) {
+            _sessions.add(sessionID, orderID);
+            it->second.inSession = true;
+        }
+        return true;
+    }
+
+    /// Add a good-till-time order: a limit order that's cancelled when advanceTime reaches expireTime.
+    /// @return false when duplicate orderID or expireTime <= currentTime().
+    bool matchAddGTTOrder(OrderID orderID, Side side, Qty qty, CentPrice price, Timestamp expireTime) {
+        JZ_LATENCY_SCOPE(MsgType::AddOrderRequest);
+        if (expireTime <= _expiries.now()) {
+            _eventReporter.onError(orderID, MsgType::AddOrderRequest, ErrCode::Expired, "");
+            return false;
+        }
+        if (!matchAddNewOrderImpl(orderID, side, qty, price, TimeInForce::GTC, 0)) return false;
+        if (auto it = _orderKeyByOrderIDMap.find(orderID); it != _orderKeyByOrderIDMap.end()) {
+            it->second.expiryTimer = _expiries.add(expireTime, orderID);
+        }
+        return true;
+    }
+
+    /// Move the current time forward, e.g. to the timestamp of an input message, and cancel good-till-time orders with
+    /// expireTime <= now, each in O(1), reported in an ExpiryMsg to an ExpiryReporter. Time doesn't go backwards.
+    /// @return number of expired orders.
+    size_t advanceTime(Timestamp now) {
+        size_t nExpired = 0;
+        _expiries.advance(now, [&](internal::ExpiryWheel::TimerID timer, OrderID orderID) {
+            auto it = _orderKeyByOrderIDMap.find(orderID);
+            if (it == _orderKeyByOrderIDMap.end() || it->second.expiryTimer != timer) return; // filled or cancelled
+            const internal::OrderInfo &orderInfo = *it->second.iterList;
+            ExpiryMsg                  msg{.orderID    = orderID,
+                                           .side       = it->second.side,
+                                           .price      = it->second.iterMap->first,
+                                           .qty        = orderInfo.qty + orderInfo.hiddenQty,
+                                           .expireTime = _expiries.now()};
+            _books[int(msg.side)].cancelOrder(it, _eventReporter);
+            if constexpr (ExpiryReporter<BookEventReporterT>) _eventReporter.onExpiry(msg);
+            ++nExpired;
+        });
+        publishBBO();
+        return nExpired;
+    }
+
+    Timestamp currentTime() const { return _expiries.now(); }
+
+    /// Add a pegged order. Its price is computed from the top of book when it's matched, so it moves with the BBO at no cost: a Primary
+    /// order needs a level on its side, a Midpoint order a level on both sides. At the same price, orders of the levels match first,
+    /// then Primary, then Midpoint orders, each in time priority. It has no owner, so self-trade prevention doesn't apply to it.
+    /// It can be cancelled, not amended or replaced.
+    /// @return false when duplicate orderID.
+    bool matchAddPeggedOrder(OrderID orderID, Side side, Qty qty, PegType peg) {
+        JZ_LATENCY_SCOPE(MsgType::AddOrderRequest);
+        assert(peg != PegType::None);
+        if (isKnownOrderID(orderID)) {
             _eventReporter.onError(orderID, MsgType::AddOrderRequest, ErrCode::DuplicateOrderID, "");
             return false;
         }
+        // risk: checked at the peg price; without one it rests unmatched, so the reference price stands in for it.
+        std::optional<CentPrice> price = pegPrices(int(side))[int(peg) - 1];
+        if (!passRiskChecks(orderID, 0, side, qty, price ? *price : riskReferencePrice().value_or(0))) return false;
+        // only Midpoint orders of the other side can match its price.
+        if (price) qty = matchOtherSide((int(side) + 1) % 2, orderID, qty, *price, 0, SelfTrade::CancelResting);
+        if (qty) _books[int(side)].addPeggedOrder(orderID, qty, peg, _eventReporter);
+        releaseTriggeredStops();
+        publishBBO();
+        return true;
+    }
 
-        int otherSide = (int(side) + 1) % 2;
+    /// Add an iceberg (reserve) order: it matches with its whole qty, then rests showing displayQty at a time. When the displayed
+    /// part is filled, the next part from the hidden reserve is displayed at the back of the level. Level aggregates and market data
+    /// only include the displayed qty.
+    /// @return false when duplicate orderID or displayQty <= 0.
+    bool matchAddIcebergOrder(OrderID orderID, Side side, Qty qty, CentPrice price, Qty displayQty) {
+        JZ_LATENCY_SCOPE(MsgType::AddOrderRequest);
+        if (displayQty <= 0) {
+            _eventReporter.onError(orderID, MsgType::AddOrderRequest, ErrCode::QtyTooSmall, "displayQty");
+            return false;
+        }
+        return matchAddNewOrderImpl(orderID, side, qty, price, TimeInForce::GTC, displayQty);
+    }
+
+    /// Match a market order. It trades with the other side until it's filled, the other side is empty, or the next level is more than
+    /// protectionTicks away from the other side's best price when the order arrives. The band is computed once, so a sweep stops at
+    /// a known level. The remaining qty is discarded: a market order never rests.
+    /// @param protectionTicks  negative for no protection.
+    /// @return false if orderID is a duplicate.
+    bool matchMarketOrder(OrderID orderID, Side side, Qty qty, CentPrice protectionTicks = NoPriceProtection) {
+        JZ_LATENCY_SCOPE(MsgType::AddOrderRequest);
+        return matchMarketOrderImpl(orderID, side, qty, protectionTicks);
+    }
 
-        qty = _books[otherSide].tryMatchOtherSide(orderID, qty, price, _eventReporter);
-        if (qty) { // add to book if there are remainings
-            _books[int(side)].addNewOrder(orderID, qty, price);
+    /// Add a post-only order: it only rests, never trades. If it would match the other side's best price, an O(1) check, it's rejected
+    /// with ErrCode::WouldTrade, or slid to one tick away from that price. The price it rests at is reported in an OrderAckMsg.
+    /// @return false when duplicate orderID or rejected.
+    bool addPostOnlyOrder(OrderID orderID, Side side, Qty qty, CentPrice price, PostOnly mode = PostOnly::Reject) {
+        JZ_LATENCY_SCOPE(MsgType::AddOrderRequest);
+        if (isKnownOrderID(orderID)) {
+            _eventReporter.onError(orderID, MsgType::AddOrderRequest, ErrCode::DuplicateOrderID, "");
+            return false;
         }
+        if (!passRiskChecks(orderID, 0, side, qty, price)) return false;
+        int        otherSide = (int(side) + 1) % 2;
+        DepthLevel otherBest = _books[otherSide].top();
+        CentPrice  restPrice = price;
+        if (otherBest.nOrders && _books[otherSide].canMatch(otherBest.price, price)) {
+            if (mode == PostOnly::Reject) {
+                _eventReporter.onError(orderID, MsgType::AddOrderRequest, ErrCode::WouldTrade, "");
+                return false;
+            }
+            restPrice = side == Side::Buy ? otherBest.price - 1 : otherBest.price + 1;
+        }
+        _books[int(side)].addNewOrder(orderID, qty, restPrice, 0, 0, _eventReporter);
+        if constexpr (OrderAckReporter<BookEventReporterT>) {
+            _eventReporter.onOrderAck(OrderAckMsg{.orderID = orderID, .side = side, .qty = qty, .price = restPrice, .requestedPrice = price});
+        }
+        publishBBO();
         return true;
     }
 
+    /// Add a stop order. It waits in the stop index of its side, outside the book, until a trade price reaches stopPrice (>= for a buy,
+    /// <= for a sell); then it's released as a market order, or as a limit order at limitPrice for a stop-limit order. Stop orders
+    /// triggered by a match are released after it in trigger order (stop price, then time), and the trades of each released order may
+    /// trigger more: they're processed from a queue, not recursively. If the last trade has already reached stopPrice, the order is
+    /// released right away. Stop orders can be cancelled with cancelOrder, not amended.
+    /// @return false when duplicate orderID or qty <= 0.
+    bool addStopOrder(OrderID orderID, Side side, Qty qty, CentPrice stopPrice) {
+        JZ_LATENCY_SCOPE(MsgType::AddOrderRequest);
+        return addStopOrderImpl(
+                internal::StopOrder{.orderID = orderID, .side = side, .isStopLimit = false, .qty = qty, .limitPrice = 0}, stopPrice);
+    }
+    bool addStopLimitOrder(OrderID orderID, Side side, Qty qty, CentPrice stopPrice, CentPrice limitPrice) {
+        JZ_LATENCY_SCOPE(MsgType::AddOrderRequest);
+        return addStopOrderImpl(
+                internal::StopOrder{.orderID = orderID, .side = side, .isStopLimit = true, .qty = qty, .limitPrice = limitPrice}, stopPrice);
+    }
+
     /// cancel a client order
     /// @return false when orderID is not found.
     bool cancelOrder(OrderID orderID) {
+        JZ_LATENCY_SCOPE(MsgType::CancelOrderRequest);
         if (auto it = _orderKeyByOrderIDMap.find(orderID); it != _orderKeyByOrderIDMap.end()) { // SideBook erases it.
-            _books[int(it->second.side)].cancelOrder(it);
+            cancelExpiry(it->second);
+            _books[int(it->second.side)].cancelOrder(it, _eventReporter);
+        } else if (auto itStop = _stopByOrderID.find(orderID); itStop != _stopByOrderID.end()) {
+            _stops[int(itStop->second->second.side)].erase(itStop->second);
+            _stopByOrderID.erase(itStop);
+            return true; // not in the book
         } else {
             _eventReporter.onError(orderID, MsgType::CancelOrderRequest, ErrCode::UnknownOrderID, "");
             return false;
         }
+        publishBBO();
         return true;
     }
 
+    /// Mass cancel, e.g. on a disconnect or a kill switch. Whole levels are dropped at once and their orderIDs are erased in the same
+    /// pass; cancelAll clears the orderID map instead. cancelAll and cancelSide also cancel stop and pegged orders, they're counted in
+    /// nOrders but have no market data events. Events are per order or one summary, see CancelReport.
+    /// @return number of cancelled orders.
+    size_t cancelAll(CancelReport report = CancelReport::PerOrder) {
+        MassCancelMsg summary{.scope = MassCancelMsg::All, .loPrice = MinPrice, .hiPrice = MaxPrice, .nOrders = _stopByOrderID.size()};
+        for (auto &book : _books) {
+            book.cancelLevels(MinPrice, MaxPrice, report, false, summary, _eventReporter);
+            book.cancelPeggedOrders(false, summary);
+        }
+        for (auto &stops : _stops) stops.clear();
+        _orderKeyByOrderIDMap.clear();
+        _sessions.clear();
+        if constexpr (RiskT::TracksAccounts) _risk.clearOpenOrders();
+        _stopByOrderID.clear();
+        return finishMassCancel(report, summary);
+    }
+    size_t cancelSide(Side side, CancelReport report = CancelReport::PerOrder) {
+        MassCancelMsg summary{.scope = MassCancelMsg::OneSide, .side = side, .loPrice = MinPrice, .hiPrice = MaxPrice};
+        _books[int(side)].cancelLevels(MinPrice, MaxPrice, report, true, summary, _eventReporter);
+        _books[int(side)].cancelPeggedOrders(true, summary);
+        for (const auto &[stopPrice, stop] : _stops[int(side)]) _stopByOrderID.erase(stop.orderID);
+        summary.nOrders += _stops[int(side)].size();
+        _stops[int(side)].clear();
+        return finishMassCancel(report, summary);
+    }
+    /// cancel orders of a side with a price in [lo, hi].
+    size_t cancelPriceRange(Side side, CentPrice lo, CentPrice hi, CancelReport report = CancelReport::PerOrder) {
+        MassCancelMsg summary{.scope = MassCancelMsg::PriceRange, .side = side, .loPrice = lo, .hiPrice = hi};
+        _books[int(side)].cancelLevels(lo, hi, report, true, summary, _eventReporter);
+        return finishMassCancel(report, summary);
+    }
+
+    /// Cancel the resting orders of a gateway session, e.g. when it drops. Only the session's list is walked, so it's
+    /// O(orders of the session) whatever the size of the book; its slots are freed at once. Each order is reported as by cancelOrder.
+    /// @return number of cancelled orders.
+    size_t cancelSession(SessionID sessionID) {
+        size_t nCancelled = _sessions.release(sessionID, [&](OrderID orderID) {
+            auto it = _orderKeyByOrderIDMap.find(orderID);
+            assert(it != _orderKeyByOrderIDMap.end() && "Logic Error: a session's order is unlinked when it's removed");
+            it->second.inSession = false; // released with the list.
+            cancelExpiry(it->second);
+            _books[int(it->second.side)].cancelOrder(it, _eventReporter);
+        });
+        publishBBO();
+        return nCancelled;
+    }
+    size_t countSessionOrders() const { return _sessions.size(); }
+
     /// partial cancel (reduce qty and priority doesn't change).
     /// @return false if orderID is not found or cancelledQty > orderQty.
     /// @note if cancelledQty > orderQty, it's a cancelOrder
     bool partialCancelOrder(OrderID orderID, Qty cancelledQty) {
+        JZ_LATENCY_SCOPE(MsgType::PartialCancelRequest);
         if (auto it = _orderKeyByOrderIDMap.find(orderID); it != _orderKeyByOrderIDMap.end()) { // SideBook erases it.
-            internal::OrderInfo &orderInfo = *it->second.iterList;
-            if (orderInfo.qty < cancelledQty) {
+            if (it->second.peg != PegType::None) {
+                _eventReporter.onError(orderID, MsgType::PartialCancelRequest, ErrCode::Pegged, "");
+                return false;
+            }
+            Qty orderQty = it->second.iterList->qty + it->second.iterList->hiddenQty;
+            if (orderQty < cancelledQty) {
                 _eventReporter.onError(orderID, MsgType::PartialCancelRequest, ErrCode::QtyTooLarge, "");
                 return false;
             }
-            orderInfo.qty -= cancelledQty;
-            if (orderInfo.qty <= 0) {
-                _books[int(it->second.side)].cancelOrder(it); // cancel
+            if (orderQty - cancelledQty <= 0) {
+                cancelExpiry(it->second);
+                _books[int(it->second.side)].cancelOrder(it, _eventReporter); // cancel
+            } else {
+                _books[int(it->second.side)].amendOrderQty(it, orderQty - cancelledQty, orderID, _eventReporter); // keeps the level's totalQty
             }
         } else {
             _eventReporter.onError(orderID, MsgType::PartialCancelRequest, ErrCode::UnknownOrderID, "");
             return false;
         }
+        publishBBO();
         return true;
     }
 
-    /// Replace order with new qty & price
+    /// Amend qty & price of a resting order, and optionally its orderID, without freeing the order.
+    ///  - qty down at the same price: mutate in place and keep priority.
+    ///  - qty up at the same price: move to the back of the level.
+    ///  - price change: match the other side if it crosses, then move the remaining to the back of the new level.
+    /// @param newQty  new leaves qty.
+    /// @return false if orderID is not found, newOrderID is duplicate or newQty <= 0.
+    bool amendOrder(OrderID orderID, OrderID newOrderID, Qty newQty, CentPrice newPrice) {
+        JZ_LATENCY_SCOPE(MsgType::AmendOrderRequest);
+        return amendOrderImpl(MsgType::AmendOrderRequest, orderID, newOrderID, newQty, newPrice);
+    }
+    bool amendOrder(OrderID orderID, Qty newQty, CentPrice newPrice) { return amendOrder(orderID, orderID, newQty, newPrice); }
+
+    /// Replace order with new qty & price. A qty reduction at the same price keeps priority (see amendOrder).
     /// @return false if originalOrderID is not found or newOrderID is duplicate
     bool replaceOrder(OrderID originalOrderID, OrderID newOrderID, Qty qty, CentPrice price) {
-        if (newOrderID == originalOrderID || _orderKeyByOrderIDMap.contains(newOrderID)) {
+        JZ_LATENCY_SCOPE(MsgType::ReplaceOrderRequest);
+        if (newOrderID == originalOrderID) {
             _eventReporter.onError(
                     newOrderID, MsgType::ReplaceOrderRequest, ErrCode::DuplicateOrderID, "originalOrderID: " + std::to_string(originalOrderID));
             return false;
         }
-        Side side;
-        if (auto it = _orderKeyByOrderIDMap.find(originalOrderID); it != _orderKeyByOrderIDMap.end()) { // SideBook erases it.
-            side = it->second.side;
+        return amendOrderImpl(MsgType::ReplaceOrderRequest, originalOrderID, newOrderID, qty, price);
+    }
+
+    /// dispatch a parsed request. bookID is not checked.
+    /// @return false if the request is rejected.
+    bool handleRequest(const OrderRequest &req) {
+        switch (req.msgType) {
+            case MsgType::AddOrderRequest: return matchAddNewOrder(req.orderID, req.side, req.qty, req.price, req.timeInForce);
+            case MsgType::CancelOrderRequest: return cancelOrder(req.orderID);
+            case MsgType::PartialCancelRequest: return partialCancelOrder(req.orderID, req.qty);
+            case MsgType::ReplaceOrderRequest: return replaceOrder(req.orderID, req.newOrderID, req.qty, req.price);
+            case MsgType::AmendOrderRequest: return amendOrder(req.orderID, req.newOrderID, req.qty, req.price);
+            default: return false;
         }
-        if (!cancelOrder(originalOrderID)) return false;
-        return matchAddNewOrder(newOrderID, side, qty, price);
     }
 
+    /// Load resting orders, e.g. good-till-cancel orders carried over at session start. Orders are validated, grouped by side, sorted into
+    /// priority order (input order within a price) and appended to their levels in one pass, without a match attempt or a level
+    /// search each. The book ends up the same as adding them one by one in input order with matchAddNewOrder, except that crossing
+    /// orders are rejected with ErrCode::CrossesBook in BulkCrossing::Reject mode. A crossing order in Match mode flushes the orders
+    /// before it and is matched. BBO updates are conflated into one.
+    /// @return number of accepted orders.
+    size_t bulkLoad(std::span<const BulkOrder> orders, BulkCrossing crossing = BulkCrossing::Reject) {
+        _orderKeyByOrderIDMap.reserve(_orderKeyByOrderIDMap.size() + orders.size()); // no rehash: pending iterKeys stay valid.
+        beginBatch();
+        TopOfBook top       = topOfBook(); // running top including pending orders. Only price & nOrders > 0 are used.
+        size_t    nAccepted = 0;
+        for (const BulkOrder &order : orders) {
+            if (order.qty <= 0) {
+                _eventReporter.onError(order.orderID, MsgType::AddOrderRequest, ErrCode::QtyTooSmall, "");
+                continue;
+            }
+            if (isKnownOrderID(order.orderID)) {
+                _eventReporter.onError(order.orderID, MsgType::AddOrderRequest, ErrCode::DuplicateOrderID, "");
+                continue;
+            }
+            int         thisSide = int(order.side), otherSide = (thisSide + 1) % 2;
+            DepthLevel &best = thisSide == 0 ? top.bid : top.ask, &otherBest = thisSide == 0 ? top.ask : top.bid;
+            if (otherBest.nOrders && _books[otherSide].canMatch(otherBest.price, order.price)) {
+                if (crossing == BulkCrossing::Reject) {
+                    _eventReporter.onError(order.orderID, MsgType::AddOrderRequest, ErrCode::CrossesBook, "");
+                    continue;
+                }
+                flushPendingOrders();
+                matchAddNewOrder(order.orderID, order.side, order.qty, order.price);
+                top = topOfBook();
+            } else {
+                auto iterKey = _orderKeyByOrderIDMap.try_emplace(order.orderID, internal::OrderKey{.side = order.side}).first;
+                _pendingOrders[thisSide].push_back(
+                        internal::PendingOrder{.orderID = order.orderID, .qty = order.qty, .price = order.price, .iterKey = iterKey});
+                if (!best.nOrders || _books[thisSide].isBetterPrice(order.price, best.price)) best = DepthLevel{.price = order.price, .nOrders = 1};
+            }
+            ++nAccepted;
+        }
+        flushPendingOrders();
+        endBatch();
+        return nAccepted;
+    }
+
+    /// Conflate BBO updates of the requests between beginBatch and endBatch into at most one. Batches may nest.
+    void beginBatch() { ++_batchDepth; }
+    void endBatch() {
+        assert(_batchDepth > 0);
+        if (--_batchDepth == 0) publishBBO();
+    }
+
+    /// Copy the resting state into a snapshot. It's a dense copy of each level, so matching pauses only for the copy;
+    /// the snapshot can be serialized afterwards (see Snapshot.h). Vectors in snapshot are reused.
+    /// Session membership isn't kept: restored orders aren't in any session.
+    void takeSnapshot(BookSnapshot &snapshot) {
+        for (int i = 0; i < 2; ++i) _books[i].takeSnapshot(snapshot.levels[i], snapshot.orders[i]);
+    }
+
+    /// Restore an empty book from a snapshot without matching.
+    /// @return false if the book isn't empty or the snapshot is inconsistent (a partially restored book should be discarded).
+    bool restoreSnapshot(const BookSnapshot &snapshot) {
+        if (!_orderKeyByOrderIDMap.empty()) return false;
+        size_t nOrders = snapshot.orders[0].size() + snapshot.orders[1].size();
+        _orderKeyByOrderIDMap.reserve(nOrders);
+        bool ok = true;
+        for (int i = 0; i < 2 && ok; ++i) ok = _books[i].restoreSnapshot(snapshot.levels[i], snapshot.orders[i]);
+        ok = ok && _orderKeyByOrderIDMap.size() == nOrders; // no duplicate orderID
+        if (ok) publishBBO();
+        return ok;
+    }
+
+    /// Counters are maintained on the hot path; probe lengths are computed by scanning the orderID map buckets, O(buckets).
+    void getStats(BookStats &stats) {
+        for (int i = 0; i < 2; ++i) stats.sides[i] = _books[i].getStats();
+        stats.nOrderIDs         = _orderKeyByOrderIDMap.size();
+        stats.nOrderIDBuckets   = _orderKeyByOrderIDMap.bucket_count();
+        stats.orderIDLoadFactor = _orderKeyByOrderIDMap.load_factor();
+        size_t totalProbes = 0, maxProbes = 0;
+        for (size_t i = 0; i < stats.nOrderIDBuckets; ++i) {
+            size_t n = _orderKeyByOrderIDMap.bucket_size(i);
+            totalProbes += n * (n + 1) / 2; // the k-th key of a chain takes k probes.
+            maxProbes = std::max(maxProbes, n);
+        }
+        stats.orderIDMeanProbeLength = stats.nOrderIDs ? double(totalProbes) / stats.nOrderIDs : 0;
+        stats.orderIDMaxProbeLength  = maxProbes;
+    }
+
+    /// Copy up to nLevels aggregated levels of a side, best price first, into output. O(nLevels), no allocation.
+    /// @return number of levels copied: min(nLevels, output.size(), price levels of the side).
+    size_t depth(Side side, size_t nLevels, std::span<DepthLevel> output) const { return _books[int(side)].depth(nLevels, output); }
+
+    /// Best bid & ask levels. O(1).
+    TopOfBook topOfBook() const { return TopOfBook{.bid = _books[0].top(), .ask = _books[1].top()}; }
+
     size_t countOrders(Side side) const { return _books[int(side)].countOrders(); }
     size_t countPriceLevels(Side side) const { return _books[int(side)].countPriceLevels(); }
     size_t countOrdersAtPrice(Side side, CentPrice price) const { return _books[int(side)].countOrdersAtPrice(price); }
+    size_t countStopOrders(Side side) const { return _stops[int(side)].size(); }
+    size_t countPeggedOrders(Side side) const { return _books[int(side)].countPeggedOrders(); }
+
+    /// The pre-trade risk stage, e.g. to set its limits.
+    RiskT       &risk() { return _risk; }
+    const RiskT &risk() const { return _risk; }
+
+private:
+    bool matchAddNewOrderImpl(OrderID     orderID,
+                              Side        side,
+                              Qty         qty,
+                              CentPrice   price,
+                              TimeInForce timeInForce,
+                              Qty         displayQty,
+                              OwnerID     ownerID   = 0,
+                              SelfTrade   selfTrade = SelfTrade::CancelResting) {
+        if (isKnownOrderID(orderID)) {
+            _eventReporter.onError(orderID, MsgType::AddOrderRequest, ErrCode::DuplicateOrderID, "");
+            return false;
+        }
+        if (!passRiskChecks(orderID, ownerID, side, qty, price)) return false;
+
+        int otherSide = (int(side) + 1) % 2;
+        if (timeInForce == TimeInForce::FOK && !_books[otherSide].canFill(qty, price, otherPegPrices(otherSide), ownerID, selfTrade)) {
+            _eventReporter.onError(orderID, MsgType::AddOrderRequest, ErrCode::NotFillable, "");
+            return false;
+        }
+
+        qty = matchOtherSide(otherSide, orderID, qty, price, ownerID, selfTrade);
+        if (qty && timeInForce == TimeInForce::GTC) { // add to book if there are remainings
+            _books[int(side)].addNewOrder(orderID, qty, price, displayQty, ownerID, _eventReporter);
+        }
+        releaseTriggeredStops();
+        publishBBO();
+        return true;
+    }
+
+    bool matchMarketOrderImpl(OrderID orderID, Side side, Qty qty, CentPrice protectionTicks) {
+        if (isKnownOrderID(orderID)) {
+            _eventReporter.onError(orderID, MsgType::AddOrderRequest, ErrCode::DuplicateOrderID, "");
+            return false;
+        }
+
+        int        otherSide  = (int(side) + 1) % 2;
+        DepthLevel otherBest  = _books[otherSide].top();
+        CentPrice  limitPrice = side == Side::Buy ? MaxPrice : MinPrice;
+        if (protectionTicks >= 0 && otherBest.nOrders) {
+            int64_t bandPrice = side == Side::Buy ? int64_t(otherBest.price) + protectionTicks : int64_t(otherBest.price) - protectionTicks;
+            limitPrice        = CentPrice(std::clamp<int64_t>(bandPrice, MinPrice, MaxPrice));
+        }
+        // risk: checked at the protection band limit, else at the touch. Against an empty side nothing trades.
+        if (otherBest.nOrders && !passRiskChecks(orderID, 0, side, qty, protectionTicks >= 0 ? limitPrice : otherBest.price)) return false;
+        matchOtherSide(otherSide, orderID, qty, limitPrice, 0, SelfTrade::CancelResting);
+        releaseTriggeredStops();
+        publishBBO();
+        return true;
+    }
+
+    /// prices of the pegged orders of a side from the current top of book. O(1).
+    internal::PegPrices pegPrices(int side) const {
+        internal::PegPrices prices;
+        DepthLevel          best = _books[side].top(), otherBest = _books[(side + 1) % 2].top();
+        if (best.nOrders) prices[int(PegType::Primary) - 1] = best.price;
+        if (best.nOrders && otherBest.nOrders) { // floor for buy, ceil for sell.
+            int64_t sum                        = int64_t(best.price) + otherBest.price;
+            prices[int(PegType::Midpoint) - 1] = CentPrice(side == int(Side::Buy) ? sum >> 1 : (sum + 1) >> 1);
+        }
+        return prices;
+    }
+
+    /// pegPrices of the side an aggressive order matches; not computed if it has no pegged order.
+    internal::PegPrices otherPegPrices(int otherSide) const {
+        return _books[otherSide].hasPeggedOrders() ? pegPrices(otherSide) : internal::PegPrices{};
+    }
+
+    void cancelExpiry(const internal::OrderKey &orderKey) {
+        if (orderKey.expiryTimer != internal::ExpiryWheel::NoTimer) _expiries.cancel(orderKey.expiryTimer);
+    }
+
+    bool isKnownOrderID(OrderID orderID) const {
+        return _orderKeyByOrderIDMap.contains(orderID) || (!_stopByOrderID.empty() && _stopByOrderID.contains(orderID));
+    }
+
+    /// @param amendedQty  leaves qty of the resting order an amend or replace changes, 0 for a new order.
+    /// @return false if the risk stage rejects the order, reported as an error. Compiled away without risk checks.
+    bool passRiskChecks(OrderID   orderID,
+                        OwnerID   ownerID,
+                        Side      side,
+                        Qty       qty,
+                        CentPrice price,
+                        MsgType   msgType    = MsgType::AddOrderRequest,
+                        Qty       amendedQty = 0) {
+        if constexpr (RiskT::Enabled) {
+            auto referencePrice = [this] { return riskReferencePrice(); };
+            if (std::optional<ErrCode> errCode = _risk.check(ownerID, side, qty, price, referencePrice, amendedQty)) {
+                _eventReporter.onError(orderID, msgType, *errCode, "");
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// reference price of the price band: the last trade, else the middle of the BBO, else the best price of the side that has orders.
+    std::optional<CentPrice> riskReferencePrice() const {
+        if (_hasTraded) return _lastTradePrice;
+        DepthLevel bid = _books[0].top(), ask = _books[1].top();
+        if (bid.nOrders && ask.nOrders) return CentPrice((int64_t(bid.price) + ask.price) / 2);
+        if (bid.nOrders || ask.nOrders) return bid.nOrders ? bid.price : ask.price;
+        return std::nullopt;
+    }
+
+    /// match an aggressive order against a side and keep the range of trade prices for the stop orders.
+    /// @return remaining qty after match
+    Qty matchOtherSide(int otherSide, OrderID orderID, Qty qty, CentPrice price, OwnerID ownerID, SelfTrade selfTrade) {
+        auto    &book    = _books[otherSide];
+        uint64_t nFills  = book.countFills();
+        Qty      leftQty = book.tryMatchOtherSide(orderID, qty, price, ownerID, selfTrade, otherPegPrices(otherSide), _eventReporter);
+        if (book.countFills() != nFills) {
+            _lastTradePrice = book.lastTradePrice();
+            _hasTraded      = true;
+            if (!_stopByOrderID.empty()) { // trade prices are monotonic in a match.
+                _minTradePrice = std::min({_minTradePrice, book.firstTradePrice(), _lastTradePrice});
+                _maxTradePrice = std::max({_maxTradePrice, book.firstTradePrice(), _lastTradePrice});
+            }
+        }
+        return leftQty;
+    }
+
+    bool addStopOrderImpl(const internal::StopOrder &stop, CentPrice stopPrice) {
+        if (isKnownOrderID(stop.orderID)) {
+            _eventReporter.onError(stop.orderID, MsgType::AddOrderRequest, ErrCode::DuplicateOrderID, "");
+            return false;
+        }
+        if (stop.qty <= 0) {
+            _eventReporter.onError(stop.orderID, MsgType::AddOrderRequest, ErrCode::QtyTooSmall, "");
+            return false;
+        }
+        _stopByOrderID.emplace(stop.orderID, _stops[int(stop.side)].emplace(stopPrice, stop));
+        if (_hasTraded) { // check it against the last trade
+            _minTradePrice = std::min(_minTradePrice, _lastTradePrice);
+            _maxTradePrice = std::max(_maxTradePrice, _lastTradePrice);
+            releaseTriggeredStops();
+            publishBBO();
+        }
+        return true;
+    }
+
+    /// Move stop orders whose stop price is in reach of the trade prices since the last call to the back of _triggeredStops:
+    /// buy stops first, each side in trigger order.
+    void collectTriggeredStops() {
+        auto &buyStops = _stops[int(Side::Buy)], &sellStops = _stops[int(Side::Sell)];
+        for (; !buyStops.empty() && buyStops.begin()->first <= _maxTradePrice; buyStops.erase(buyStops.begin())) {
+            _triggeredStops.push_back(buyStops.begin()->second);
+            _stopByOrderID.erase(buyStops.begin()->second.orderID);
+        }
+        for (; !sellStops.empty() && sellStops.begin()->first >= _minTradePrice; sellStops.erase(sellStops.begin())) {
+            _triggeredStops.push_back(sellStops.begin()->second);
+            _stopByOrderID.erase(sellStops.begin()->second.orderID);
+        }
+        _minTradePrice = MaxPrice;
+        _maxTradePrice = MinPrice;
+    }
+
+    /// Release triggered stop orders in FIFO order until no more are triggered. Orders released here trigger more stops by
+    /// appending to the queue; the nested calls return right away. BBO updates are left to the caller.
+    void releaseTriggeredStops() {
+        if (_releasingStops || _minTradePrice > _maxTradePrice) return;
+        _releasingStops = true;
+        ++_batchDepth;
+        for (size_t next = 0;; ++next) {
+            collectTriggeredStops();
+            if (next == _triggeredStops.size()) break;
+            internal::StopOrder stop = _triggeredStops[next];
+            if (stop.isStopLimit) matchAddNewOrderImpl(stop.orderID, stop.side, stop.qty, stop.limitPrice, TimeInForce::GTC, 0);
+            else matchMarketOrderImpl(stop.orderID, stop.side, stop.qty, NoPriceProtection);
+        }
+        _triggeredStops.clear();
+        --_batchDepth;
+        _releasingStops = false;
+    }
+
+    size_t finishMassCancel(CancelReport report, const MassCancelMsg &summary) {
+        if constexpr (MassCancelReporter<BookEventReporterT>) {
+            if (report == CancelReport::Summary) _eventReporter.onMassCancel(summary);
+        }
+        publishBBO();
+        return summary.nOrders;
+    }
+
+    void flushPendingOrders() {
+        for (int i = 0; i < 2; ++i) {
+            _books[i].bulkAddOrders(_pendingOrders[i], _eventReporter);
+            _pendingOrders[i].clear();
+        }
+    }
+
+    /// report the BBO to a BBOReporter if it changed since last reported. O(1); compiled away for other reporters.
+    void publishBBO() {
+        if constexpr (BBOReporter<BookEventReporterT>) {
+            if (_batchDepth) return;
+            TopOfBook bbo = topOfBook();
+            if (bbo == _publishedBBO) return;
+            _publishedBBO = bbo;
+            _eventReporter.onBBO(bbo);
+        }
+    }
+
+    bool amendOrderImpl(MsgType msgType, OrderID orderID, OrderID newOrderID, Qty newQty, CentPrice newPrice) {
+        auto it = _orderKeyByOrderIDMap.find(orderID);
+        if (it == _orderKeyByOrderIDMap.end()) {
+            _eventReporter.onError(orderID, msgType, ErrCode::UnknownOrderID, "");
+            return false;
+        }
+        if (newOrderID != orderID && isKnownOrderID(newOrderID)) {
+            _eventReporter.onError(newOrderID, msgType, ErrCode::DuplicateOrderID, "originalOrderID: " + std::to_string(orderID));
+            return false;
+        }
+        if (newQty <= 0) {
+            _eventReporter.onError(orderID, msgType, ErrCode::QtyTooSmall, "");
+            return false;
+        }
+        if (it->second.peg != PegType::None) {
+            _eventReporter.onError(orderID, msgType, ErrCode::Pegged, "");
+            return false;
+        }
+        int                        thisSide  = int(it->second.side);
+        internal::SideBook<RiskT> &book      = _books[thisSide];
+        bool                       samePrice = newPrice == it->second.iterMap->first;
+        Qty                        leftQty   = newQty;
+        const internal::OrderInfo &orderInfo = *it->second.iterList;
+        Qty                        leavesQty = orderInfo.qty + orderInfo.hiddenQty;
+        if ((!samePrice || newQty > leavesQty) &&
+            !passRiskChecks(orderID, orderInfo.ownerID, Side(thisSide), newQty, newPrice, msgType, leavesQty))
+            return false;
+        if (!samePrice) {
+            // the other side doesn't touch this order's map entry while matching.
+            leftQty = matchOtherSide((thisSide + 1) % 2, newOrderID, newQty, newPrice, it->second.iterList->ownerID, SelfTrade::CancelResting);
+            if (!leftQty) {
+                cancelExpiry(it->second);
+                book.cancelOrder(it, _eventReporter); // traded away under the original orderID.
+                releaseTriggeredStops();
+                publishBBO();
+                return true;
+            }
+        }
+        if (newOrderID != orderID) { // rekey the map node in place, no reallocation.
+            auto node                       = _orderKeyByOrderIDMap.extract(it);
+            node.key()                      = newOrderID;
+            node.mapped().iterList->orderID = newOrderID;
+            if (node.mapped().expiryTimer != internal::ExpiryWheel::NoTimer) _expiries.value(node.mapped().expiryTimer) = newOrderID;
+            if (node.mapped().inSession) _sessions.setOrderID(orderID, newOrderID);
+            it                              = _orderKeyByOrderIDMap.insert(std::move(node)).position;
+        }
+        if (samePrice) {
+            book.amendOrderQty(it, newQty, orderID, _eventReporter);
+        } else {
+            book.moveOrderToPrice(it, leftQty, newPrice, orderID, _eventReporter);
+        }
+        releaseTriggeredStops();
+        publishBBO();
+        return true;
+    }
 };
 
 inline void formatError(std::ostream &ostream, OrderID orderID, MsgType msgType, ErrCode errCode, const std::string &errMsg) {
@@ -333,6 +1990,18 @@ inline void formatError(std::ostream &ostream, OrderID orderID, MsgType msgType,
         case ErrCode::UnknownOrderID: errStr = "UnknownOrderID"; break;
         case ErrCode::QtyTooLarge: errStr = "QtyTooLarge"; break;
         case ErrCode::QtyTooSmall: errStr = "QtyTooSmall"; break;
+        case ErrCode::CrossesBook: errStr = "CrossesBook"; break;
+        case ErrCode::NotFillable: errStr = "NotFillable"; break;
+        case ErrCode::WouldTrade: errStr = "WouldTrade"; break;
+        case ErrCode::Expired: errStr = "Expired"; break;
+        case ErrCode::Pegged: errStr = "Pegged"; break;
+        case ErrCode::InvalidSession: errStr = "InvalidSession"; break;
+        case ErrCode::QtyLimit: errStr = "QtyLimit"; break;
+        case ErrCode::NotionalLimit: errStr = "NotionalLimit"; break;
+        case ErrCode::PriceBand: errStr = "PriceBand"; break;
+        case ErrCode::OpenOrderLimit: errStr = "OpenOrderLimit"; break;
+        case ErrCode::PositionLimit: errStr = "PositionLimit"; break;
+        case ErrCode::UnknownAccount: errStr = "UnknownAccount"; break;
     }
     ostream << "Error: " << errStr << ", orderID: " << orderID << ". " << errMsg << std::endl;
 }
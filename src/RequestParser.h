@@ -0,0 +1,159 @@
+#pragma once
+#include <iostream>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <concepts>
+#include <iterator>
+#include <cmath>
+#include <cstdio>
+
+#include "OrderBook.h"
+
+#define EXPECT_OR_ERR(expr, err_func, err_msg)                                                                                                      \
+    do {                                                                                                                                            \
+        if (not(expr)) {                                                                                                                            \
+            std::cerr << err_msg << std::endl;                                                                                                      \
+            err_func;                                                                                                                               \
+        }                                                                                                                                           \
+    } while (false)
+
+namespace StrUtil {
+inline void ltrim_str(std::string &s) {
+    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](char c) { return !std::isspace(c); }));
+}
+inline void rtrim_str(std::string &s) {
+    s.erase(std::find_if(s.rbegin(), s.rend(), [](char c) { return !std::isspace(c); }).base(), s.end());
+}
+inline void trim_str(std::string &s) {
+    ltrim_str(s);
+    rtrim_str(s);
+}
+
+/// if onReadStr(index, std::string& str) returns void or bool, if return false, exit parsing.
+/// Note that str could be empty.
+int read_each_str(std::istream &istrm, char delim, std::invocable<int, std::string &> auto &&onReadStr) {
+    using RetType = decltype(onReadStr(std::declval<int>(), std::declval<std::string &>()));
+    static_assert(std::is_convertible_v<RetType, bool> || std::is_same_v<RetType, void>, "onReadStr returns void or bool");
+
+    int         seq = 0;
+    std::string line;
+    while (std::getline(istrm, line, delim)) {
+        trim_str(line);
+        if constexpr (std::is_convertible_v<RetType, bool>) {
+            if (not onReadStr(seq++, line)) { // return false to exit
+                break;
+            }
+        } else {
+            onReadStr(seq++, line);
+        }
+    }
+    return seq;
+}
+
+inline std::vector<std::string> split_str(const std::string &s, char delim) {
+    std::vector<std::string> res;
+    std::stringstream        ss(s);
+    read_each_str(ss, delim, [&](int, std::string &word) { res.push_back(std::move(word)); });
+    return res;
+}
+} // namespace StrUtil
+
+/// Parse a CSV request line:
+///  - AddOrderRequest:      0,orderid,side,qty,price[,timeInForce]   timeInForce: 0 GTC (default), 1 IOC, 2 FOK
+///  - CancelOrderRequest:   1,orderid
+///  - PartialCancelRequest: 5,orderid,cancelledQty
+///  - ReplaceOrderRequest:  6,orderid,newOrderid,qty,price
+///  - AmendOrderRequest:    7,orderid,newOrderid,qty,price
+/// Errors are printed to stderr.
+/// @return false if the line is invalid.
+inline bool parseRequestLine(int iLine, const std::string &line, OrderRequest &req) {
+    // number of fields by MsgType, the last optionalFields of them may be omitted.
+    static constexpr int requestFields[]  = {6, 2, 0, 0, 0, 3, 5, 5};
+    static constexpr int optionalFields[] = {1, 0, 0, 0, 0, 0, 0, 0};
+    static const char   *requestNames[]  = {
+            "AddOrderRequest(0)", "CancelOrderRequest(1)", "", "", "", "PartialCancelRequest(5)", "ReplaceOrderRequest(6)", "AmendOrderRequest(7)"};
+
+    req = OrderRequest{};
+    std::stringstream ss(line);
+    bool              ok      = true;
+    int               nFields = StrUtil::read_each_str(ss, ',', [&](int iField, std::string &field) {
+        EXPECT_OR_ERR(!field.empty(), return ok = false, "ERROR: empty fieldNo: " << iField << " in lineNo: " << iLine << " : " << line);
+        char       *pEnd;
+        const char *pFieldEnd = field.c_str() + field.size();
+        if (iField == 0) { // msgType
+            long msgType = std::strtol(field.c_str(), &pEnd, 10);
+            EXPECT_OR_ERR(pEnd == pFieldEnd && msgType >= 0 && msgType < long(std::size(requestFields)) && requestFields[msgType] > 0,
+                          return ok = false,
+                          "ERROR: invalid MsgType: " << field << " in lineNo: " << iLine << " : " << line);
+            req.msgType = MsgType(msgType);
+        } else if (iField == 1) {
+            req.orderID = std::strtoull(field.c_str(), &pEnd, 10);
+            EXPECT_OR_ERR(pEnd == pFieldEnd, return ok = false, "ERROR: field parse orderID in lineNo: " << iLine << " : " << line);
+        } else {
+            EXPECT_OR_ERR(iField < requestFields[int(req.msgType)],
+                          return ok = false,
+                          "ERROR: read " << requestNames[int(req.msgType)] << " too many fieldNo: " << iField << " in lineNo: " << iLine << " : "
+                                         << line);
+            if (iField == 2 && req.msgType == MsgType::AddOrderRequest) {
+                EXPECT_OR_ERR(field == std::to_string(int(Side::Buy)) || field == std::to_string(int(Side::Sell)),
+                              return ok = false,
+                              "ERROR: invalid side in lineNo: " << iLine << " : " << line);
+                req.side = Side(std::strtol(field.c_str(), &pEnd, 10));
+            } else if (iField == 2 && req.msgType != MsgType::PartialCancelRequest) {
+                req.newOrderID = std::strtoull(field.c_str(), &pEnd, 10);
+                EXPECT_OR_ERR(pEnd == pFieldEnd, return ok = false, "ERROR: field parse newOrderID in lineNo: " << iLine << " : " << line);
+            } else if (iField == 2 || iField == 3) {
+                req.qty = std::strtol(field.c_str(), &pEnd, 10);
+                EXPECT_OR_ERR(pEnd == pFieldEnd, return ok = false, "ERROR: field parse qty in lineNo: " << iLine << " : " << line);
+            } else if (iField == 5) { // AddOrderRequest
+                long timeInForce = std::strtol(field.c_str(), &pEnd, 10);
+                EXPECT_OR_ERR(pEnd == pFieldEnd && timeInForce >= 0 && timeInForce <= long(TimeInForce::FOK),
+                              return ok = false,
+                              "ERROR: invalid timeInForce in lineNo: " << iLine << " : " << line);
+                req.timeInForce = TimeInForce(timeInForce);
+            } else { // iField == 4
+                double price = std::strtod(field.c_str(), &pEnd);
+                EXPECT_OR_ERR(pEnd == pFieldEnd, return ok = false, "ERROR: field parse price in lineNo: " << iLine << " : " << line);
+                req.price = CentPrice(std::llround(price * 100));
+            }
+        }
+        return true;
+    });
+    if (!ok) return false; // ignore this line
+
+    int nRequiredFields = requestFields[int(req.msgType)] - optionalFields[int(req.msgType)];
+    EXPECT_OR_ERR(nFields >= nRequiredFields, return false, "ERROR: need more fields for " << requestNames[int(req.msgType)]);
+    return true;
+}
+
+/// Format a request as a CSV line that parseRequestLine reads.
+inline void formatRequestCSV(std::ostream &os, const OrderRequest &req) {
+    char buf[128];
+    int  n = 0;
+    switch (req.msgType) {
+        case MsgType::AddOrderRequest:
+            n = std::snprintf(buf, sizeof(buf), "0,%llu,%d,%d,%.2f", (unsigned long long)req.orderID, int(req.side), req.qty, req.price / 100.0);
+            if (req.timeInForce != TimeInForce::GTC) n += std::snprintf(buf + n, sizeof(buf) - n, ",%d", int(req.timeInForce));
+            buf[n++] = '\n';
+            break;
+        case MsgType::CancelOrderRequest: n = std::snprintf(buf, sizeof(buf), "1,%llu\n", (unsigned long long)req.orderID); break;
+        case MsgType::PartialCancelRequest:
+            n = std::snprintf(buf, sizeof(buf), "5,%llu,%d\n", (unsigned long long)req.orderID, req.qty);
+            break;
+        case MsgType::ReplaceOrderRequest:
+        case MsgType::AmendOrderRequest:
+            n = std::snprintf(buf,
+                              sizeof(buf),
+                              "%d,%llu,%llu,%d,%.2f\n",
+                              int(req.msgType),
+                              (unsigned long long)req.orderID,
+                              (unsigned long long)req.newOrderID,
+                              req.qty,
+                              req.price / 100.0);
+            break;
+        default: break;
+    }
+    os.write(buf, n);
+}
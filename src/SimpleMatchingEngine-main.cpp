@@ -3,151 +3,103 @@
 #include <sstream>
 #include <functional>
 #include <source_location>
+#include <span>
 
 #include "OrderBook.h"
-
-#define EXPECT_OR_ERR(expr, err_func, err_msg)                                                                                                      \
-    do {                                                                                                                                            \
-        if (not(expr)) {                                                                                                                            \
-            std::cerr << err_msg << std::endl;                                                                                                      \
-            err_func;                                                                                                                               \
-        }                                                                                                                                           \
-    } while (false)
-
-
-struct SimpleTradeReporter {
-    std::ostream &ostream = std::cout, &estream = std::cerr;
-
-    void onTrade(const TradeMsg &msg) {
-        ostream << "2," << msg.tradeQty << "," << double(msg.tradePrice / 100.0) << std::endl;
-        printFill(msg.aggressiveOrderFill);
-        printFill(msg.restingOrderFill);
-    }
-    void onError(OrderID orderID, MsgType msgType, ErrCode errCode, const std::string &errMsg) {
-        formatError(estream, orderID, msgType, errCode, errMsg);
-    }
-
-private:
-    std::ostream &printFill(const TradeMsg::Fill &fill) {
-        if (fill.isFull) {
-            ostream << "3," << fill.orderID << std::endl;
-        } else {
-            ostream << "4," << fill.orderID << "," << fill.leaveQty << std::endl;
-        }
-        return ostream;
-    }
+#include "RequestParser.h"
+#include "Journal.h"
+#include "SimpleTradeReporter.h"
+#include "BookStats.h"
+
+#ifdef JZ_LATENCY_HISTOGRAM
+#include <csignal>
+volatile std::sig_atomic_t latencyDumpRequested = 0; // set by SIGUSR1; latencies are printed by the main loop, not in the handler.
+#endif
+
+struct MainOptions {
+    std::string   journalPath; // recover from and append to the journal if not empty.
+    JournalConfig journalConfig;
+    uint64_t      statsEvery = 0; // print book stats as JSON to stderr every N requests and at exit if > 0.
 };
-static_assert(BookEventReporter<SimpleTradeReporter>, "SimpleTradeReporter Impl BookEventReporter");
-
-namespace StrUtil {
-void ltrim_str(std::string &s) {
-    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](char c) { return !std::isspace(c); }));
-}
-void rtrim_str(std::string &s) {
-    s.erase(std::find_if(s.rbegin(), s.rend(), [](char c) { return !std::isspace(c); }).base(), s.end());
-}
-void trim_str(std::string &s) {
-    ltrim_str(s);
-    rtrim_str(s);
-}
-
-/// if onReadStr(index, std::string& str) returns void or bool, if return false, exit parsing.
-/// Note that str could be empty.
-int read_each_str(std::istream &istrm, char delim, std::invocable<int, std::string &> auto &&onReadStr) {
-    using RetType = decltype(onReadStr(std::declval<int>(), std::declval<std::string &>()));
-    static_assert(std::is_convertible_v<RetType, bool> || std::is_same_v<RetType, void>, "onReadStr returns void or bool");
-
-    int         seq = 0;
-    std::string line;
-    while (std::getline(istrm, line, delim)) {
-        trim_str(line);
-        if constexpr (std::is_convertible_v<RetType, bool>) {
-            if (not onReadStr(seq++, line)) { // return false to exit
-                break;
-            }
-        } else {
-            onReadStr(seq++, line);
-        }
-    }
-    return seq;
-}
-
-std::vector<std::string> split_str(const std::string &s, char delim) {
-    std::vector<std::string> res;
-    std::stringstream        ss(s);
-    read_each_str(ss, delim, [&](int, std::string &word) { res.push_back(std::move(word)); });
-    return res;
-}
-} // namespace StrUtil
 
-int main_func() {
+int main_func(const MainOptions &options = {}) {
     SimpleTradeReporter            reporter;
     OrderBook<SimpleTradeReporter> book{reporter};
+    JournalWriter                  journal;
+    if (!options.journalPath.empty()) {
+        // mute events & errors that have been reported before restart.
+        std::streambuf   *_oldCout = std::cout.rdbuf(nullptr), *_oldCerr = std::cerr.rdbuf(nullptr);
+        JournalScanResult recovered = replayJournal(options.journalPath, std::span(&book, 1));
+        std::cout.rdbuf(_oldCout), std::cerr.rdbuf(_oldCerr);
+        EXPECT_OR_ERR(!recovered.notJournal, return 1, "ERROR: not a journal: " << options.journalPath);
+        if (recovered.ok) std::cerr << "Recovered " << recovered.nRecords << " requests from journal: " << options.journalPath << std::endl;
+        EXPECT_OR_ERR(journal.open(options.journalPath, options.journalConfig, recovered),
+                      return 1,
+                      "ERROR: failed to open journal: " << options.journalPath);
+    }
+    BookStats stats;
+    uint64_t  nRequests = 0;
     StrUtil::read_each_str(std::cin, '\n', [&](int iLine, std::string &line) {
-        MsgType msgType;
-        int     orderID;
-        Side    side;
-        int     qty;
-        double  price;
-
-        std::stringstream ss(line);
-        bool              ok      = true;
-        int               nFields = StrUtil::read_each_str(ss, ',', [&](int iField, std::string &field) {
-            EXPECT_OR_ERR(!field.empty(), return ok = false, "ERROR: empty fieldNo: " << iField << " in lineNo: " << iLine << " : " << line);
-            char       *pEnd;
-            const char *pFieldEnd = field.c_str() + field.size();
-            if (iField == 0) { // msgType
-                if (field == std::to_string(int(MsgType::AddOrderRequest))) {
-                    msgType = MsgType::AddOrderRequest; //
-                } else if (field == std::to_string(int(MsgType::CancelOrderRequest))) {
-                    msgType = MsgType::CancelOrderRequest; //
-                } else {
-                    EXPECT_OR_ERR(false, return ok = false, "ERROR: invalid MsgType: " << field << " in lineNo: " << iLine << " : " << line);
-                }
-            } else if (iField == 1) {
-                orderID = std::strtol(field.c_str(), &pEnd, 10);
-                EXPECT_OR_ERR(pEnd == pFieldEnd, return ok = false, "ERROR: field parse orderID in lineNo: " << iLine << " : " << line);
-            } else {
-                if (msgType == MsgType::AddOrderRequest) {
-                    if (iField == 2) {
-                        EXPECT_OR_ERR(field == std::to_string(int(Side::Buy)) || field == std::to_string(int(Side::Sell)),
-                                      return ok = false,
-                                      "ERROR: invalid side in lineNo: " << iLine << " : " << line);
-                        side = Side(std::strtol(field.c_str(), &pEnd, 10));
-                    } else if (iField == 3) {
-                        qty = std::strtol(field.c_str(), &pEnd, 10);
-                        EXPECT_OR_ERR(pEnd == pFieldEnd, return ok = false, "ERROR: field parse qty in lineNo: " << iLine << " : " << line);
-                    } else if (iField == 4) {
-                        price = std::strtod(field.c_str(), &pEnd);
-                        EXPECT_OR_ERR(pEnd == pFieldEnd, return ok = false, "ERROR: field parse price in lineNo: " << iLine << " : " << line);
-                    } else {
-                        EXPECT_OR_ERR(false,
-                                      return ok = false,
-                                      "ERROR: read AddOrderRequest(0) too many fieldNo: " << iField << " in lineNo: " << iLine << " : " << line);
-                    }
-                } else { // CancelOrderRequest
-                    EXPECT_OR_ERR(false,
-                                  return ok = false,
-                                  "ERROR: read CancelOrderRequest(1) too many fieldNo: " << iField << " in lineNo: " << iLine << " : " << line);
-                }
-            }
-            return true;
-        });
-        if (!ok) return; // ignore this line
-
-        if (msgType == MsgType::AddOrderRequest) {
-            EXPECT_OR_ERR(nFields == 5, return, "ERROR: need more fields for AddOrderRequest");
-            book.matchAddNewOrder(orderID, side, qty, CentPrice(price * 100));
-        } else {
-            EXPECT_OR_ERR(nFields == 2, return, "ERROR: need more fields for CancelOrderRequest");
-            book.cancelOrder(orderID);
+        OrderRequest req;
+        if (!parseRequestLine(iLine, line, req)) return true; // ignore this line
+        // journaled before matching; with group commit > 1 it's durable only after its group is flushed.
+        if (journal.isOpen() && !journal.append(req)) {
+            std::cerr << "ERROR: failed to write journal: " << options.journalPath << ", stop accepting requests." << std::endl;
+            return false;
         }
+        book.handleRequest(req);
+        if (options.statsEvery && ++nRequests % options.statsEvery == 0) {
+            book.getStats(stats);
+            writeStatsJson(std::cerr, stats, nRequests);
+        }
+#ifdef JZ_LATENCY_HISTOGRAM
+        if (latencyDumpRequested) {
+            latencyDumpRequested = 0;
+            printRequestLatencies(std::cerr);
+        }
+#endif
+        return true;
     });
-    return 0;
+#ifdef JZ_LATENCY_HISTOGRAM
+    printRequestLatencies(std::cerr);
+#endif
+    if (options.statsEvery && nRequests % options.statsEvery) { // the last one
+        book.getStats(stats);
+        writeStatsJson(std::cerr, stats, nRequests);
+    }
+    if (journal.isOpen()) {
+        bool failed = journal.failed();
+        journal.close();
+        if (!failed && journal.failed()) std::cerr << "ERROR: failed to write journal: " << options.journalPath << std::endl;
+        const JournalStats &stats = journal.stats();
+        std::cerr << "Journal records: " << stats.nRecords << ", flushes: " << stats.nFlushes << ", avgFlushUs: "
+                  << (stats.nFlushes ? stats.totalFlushNanos / stats.nFlushes / 1000 : 0) << ", maxFlushUs: " << stats.maxFlushNanos / 1000
+                  << std::endl;
+    }
+    return journal.failed() ? 1 : 0;
 }
 
 #ifndef TEST_CONFIG_IMPLEMENT_MAIN
-int main() { main_func(); }
+int main(int argc, char *argv[]) {
+    MainOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            options.journalPath = argv[++i];
+        } else if (arg == "-g" && i + 1 < argc) {
+            options.journalConfig.groupCommitRecords = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "-s" && i + 1 < argc) {
+            options.statsEvery = std::strtoull(argv[++i], nullptr, 10);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [-j journalFile] [-g groupCommitRecords] [-s statsEveryN]" << std::endl;
+            return 1;
+        }
+    }
+#if defined(JZ_LATENCY_HISTOGRAM) && !defined(_WIN32)
+    std::signal(SIGUSR1, [](int) { latencyDumpRequested = 1; });
+#endif
+    return main_func(options);
+}
 #else  //---- define TEST_CONFIG_IMPLEMENT_MAIN to build into a test program that doesn't read external input.
 /// @return output of std::cout.
 template<class Func>
@@ -163,7 +115,7 @@ std::string runWithRedirectedIO(std::string input, Func func) {
 
 auto test = [](std::string input, std::string expected, std::source_location loc = std::source_location::current()) {
     std::cout << loc.file_name() << ":" << loc.line() << "  test started. " << std::endl;
-    std::string s = runWithRedirectedIO(input, main_func);
+    std::string s = runWithRedirectedIO(input, [] { main_func(); });
     std::cout << loc.file_name() << ":" << loc.line() << "  test ended. " << std::endl;
     ASSERT_EQ(StrUtil::split_str(s, '\n'), StrUtil::split_str(expected, '\n'));
 };
@@ -0,0 +1,29 @@
+#pragma once
+#include <iostream>
+
+#include "OrderBook.h"
+
+/// SimpleTradeReporter prints events in the CSV output format: TradeEvent (2), OrderFullyFilled (3) and OrderPartiallyFilled (4).
+struct SimpleTradeReporter {
+    std::ostream &ostream = std::cout, &estream = std::cerr;
+
+    void onTrade(const TradeMsg &msg) {
+        ostream << "2," << msg.tradeQty << "," << double(msg.tradePrice / 100.0) << std::endl;
+        printFill(msg.aggressiveOrderFill);
+        printFill(msg.restingOrderFill);
+    }
+    void onError(OrderID orderID, MsgType msgType, ErrCode errCode, const std::string &errMsg) {
+        formatError(estream, orderID, msgType, errCode, errMsg);
+    }
+
+private:
+    std::ostream &printFill(const TradeMsg::Fill &fill) {
+        if (fill.isFull) {
+            ostream << "3," << fill.orderID << std::endl;
+        } else {
+            ostream << "4," << fill.orderID << "," << fill.leaveQty << std::endl;
+        }
+        return ostream;
+    }
+};
+static_assert(BookEventReporter<SimpleTradeReporter>, "SimpleTradeReporter Impl BookEventReporter");
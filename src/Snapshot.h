@@ -0,0 +1,64 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+#include "OrderBook.h"
+
+/// Binary layout of a BookSnapshot:
+///   magic "JZSNAP03", journalSeq, then for buy & sell: nLevels, nOrders, SnapshotLevel[nLevels], OrderInfo[nOrders].
+/// Integers are in host byte order. Only resting limit and iceberg orders are kept: pegged, stop and good-till-time state and the
+/// session membership of orders aren't, so orders restored from a snapshot can't be cancelled by cancelSession.
+
+static_assert(std::has_unique_object_representations_v<internal::SnapshotLevel> && std::has_unique_object_representations_v<internal::OrderInfo>,
+              "snapshot records are written as raw bytes");
+
+inline constexpr char SnapshotMagic[8] = {'J', 'Z', 'S', 'N', 'A', 'P', '0', '3'};
+
+namespace internal {
+template<class T>
+bool writeVector(std::ostream &os, const std::vector<T> &vec) {
+    return bool(os.write(reinterpret_cast<const char *>(vec.data()), std::streamsize(vec.size() * sizeof(T))));
+}
+/// Read n records in bounded chunks, so that a corrupted count fails at the end of the stream instead of allocating it up front.
+template<class T>
+bool readVector(std::istream &is, std::vector<T> &vec, uint64_t n) {
+    constexpr uint64_t ChunkSize = (1 << 20) / sizeof(T);
+    vec.clear();
+    for (uint64_t nRead = 0; nRead < n;) {
+        size_t chunk = size_t(std::min(n - nRead, ChunkSize));
+        vec.resize(nRead + chunk);
+        if (!is.read(reinterpret_cast<char *>(vec.data() + nRead), std::streamsize(chunk * sizeof(T)))) return false;
+        nRead += chunk;
+    }
+    return true;
+}
+} // namespace internal
+
+/// @return false on IO error.
+inline bool writeSnapshot(std::ostream &os, const BookSnapshot &snapshot) {
+    os.write(SnapshotMagic, sizeof(SnapshotMagic));
+    os.write(reinterpret_cast<const char *>(&snapshot.journalSeq), sizeof(snapshot.journalSeq));
+    for (int i = 0; i < 2; ++i) {
+        uint64_t sizes[2] = {snapshot.levels[i].size(), snapshot.orders[i].size()};
+        os.write(reinterpret_cast<const char *>(sizes), sizeof(sizes));
+        internal::writeVector(os, snapshot.levels[i]);
+        internal::writeVector(os, snapshot.orders[i]);
+    }
+    return bool(os.flush());
+}
+
+/// @return false on IO error or bad format.
+inline bool readSnapshot(std::istream &is, BookSnapshot &snapshot) {
+    char magic[sizeof(SnapshotMagic)];
+    if (!is.read(magic, sizeof(magic)) || std::memcmp(magic, SnapshotMagic, sizeof(magic)) != 0) return false;
+    if (!is.read(reinterpret_cast<char *>(&snapshot.journalSeq), sizeof(snapshot.journalSeq))) return false;
+    for (int i = 0; i < 2; ++i) {
+        uint64_t sizes[2];
+        if (!is.read(reinterpret_cast<char *>(sizes), sizeof(sizes))) return false;
+        if (!internal::readVector(is, snapshot.levels[i], sizes[0]) || !internal::readVector(is, snapshot.orders[i], sizes[1])) return false;
+    }
+    return true;
+}
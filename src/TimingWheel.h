@@ -0,0 +1,147 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+/// TimingWheel is a hierarchical timing wheel of timers with a value each, keyed by a uint64_t time in the caller's units,
+/// e.g. nanoseconds. Level k has 64 slots of 64^k time units; a timer is kept in the lowest level where its time and the current time
+/// have the same higher base-64 digits, so 11 levels cover the whole range and there's no overflow list.
+/// Adding and cancelling a timer are O(1). Advancing the time visits only non-empty slots, found with a bitmap per level, and a timer
+/// is moved down at most once per level before it fires. Timers are in a pool linked by index; cancelled ones are reused.
+template<class T>
+class TimingWheel {
+public:
+    using TimerID                    = uint32_t;
+    static constexpr TimerID NoTimer = UINT32_MAX;
+
+private:
+    static constexpr int SlotBits  = 6;
+    static constexpr int NumSlots  = 1 << SlotBits;
+    static constexpr int NumLevels = (64 + SlotBits - 1) / SlotBits;
+
+    struct Timer {
+        uint64_t time{};
+        T        value{};
+        TimerID  prev = NoTimer, next = NoTimer; // in its slot; next is the free list link of a free timer.
+        uint16_t slot{};                         // level * NumSlots + slot in the level
+    };
+
+    std::vector<Timer>                        _timers;
+    std::array<TimerID, NumLevels * NumSlots> _slots;      // first timer of each slot
+    std::array<uint64_t, NumLevels>           _occupied{}; // bitmap of non-empty slots of each level
+    TimerID                                   _freeList = NoTimer;
+    uint64_t                                  _now{};
+    size_t                                    _size{};
+
+public:
+    explicit TimingWheel(uint64_t now = 0) : _now(now) { _slots.fill(NoTimer); }
+
+    uint64_t now() const { return _now; }
+    size_t   size() const { return _size; }
+
+    /// @return the timer's id to cancel it. A timer with time <= now fires on the next advance.
+    TimerID add(uint64_t time, const T &value) {
+        TimerID id = _freeList;
+        if (id != NoTimer) {
+            _freeList = _timers[id].next;
+        } else {
+            id = TimerID(_timers.size());
+            _timers.emplace_back();
+        }
+        _timers[id].time  = time;
+        _timers[id].value = value;
+        link(id);
+        ++_size;
+        return id;
+    }
+
+    /// @param id  a timer that hasn't fired or been cancelled.
+    void cancel(TimerID id) {
+        unlink(id);
+        release(id);
+    }
+
+    T       &value(TimerID id) { return _timers[id].value; }
+    const T &value(TimerID id) const { return _timers[id].value; }
+
+    /// Move the current time forward to now and fire the timers with time <= now in time order, calling onExpire(id, value) after
+    /// each one is removed. Timers added when already due fire first. onExpire may add and cancel timers.
+    /// @return number of fired timers.
+    template<class OnExpire>
+    size_t advance(uint64_t now, OnExpire &&onExpire) {
+        size_t nFired = 0;
+        for (;;) {
+            int level = 0, slot = -1;
+            for (; level < NumLevels && slot < 0; ++level) { // the first non-empty slot from the current time is the earliest.
+                int      digit = digitOf(_now, level);
+                uint64_t after = level == 0 ? ~uint64_t(0) << digit : digit + 1 < NumSlots ? ~uint64_t(0) << (digit + 1) : 0;
+                if (uint64_t bits = _occupied[level] & after) slot = std::countr_zero(bits);
+            }
+            if (slot < 0) break;
+            --level;
+            uint64_t slotTime = startOf(level, slot);
+            if (slotTime > now) break;
+            _now           = slotTime;
+            TimerID &first = _slots[level * NumSlots + slot];
+            if (level == 0) {
+                for (; first != NoTimer; ++nFired) {
+                    TimerID id    = first;
+                    T       value = _timers[id].value;
+                    cancel(id);
+                    onExpire(id, value);
+                }
+            } else { // cascade the slot down, relative to its start time.
+                _occupied[level] &= ~(uint64_t(1) << slot);
+                TimerID id = first;
+                first      = NoTimer;
+                for (TimerID next; id != NoTimer; id = next) {
+                    next = _timers[id].next;
+                    link(id);
+                }
+            }
+        }
+        _now = std::max(_now, now);
+        return nFired;
+    }
+
+private:
+    static int digitOf(uint64_t time, int level) { return int(time >> (level * SlotBits)) & (NumSlots - 1); }
+
+    /// start time of a slot after the current time: the current time's higher digits, then the slot's digit, then 0s.
+    uint64_t startOf(int level, int slot) const {
+        int      shift  = (level + 1) * SlotBits;
+        uint64_t higher = shift < 64 ? _now >> shift << shift : 0;
+        return higher | uint64_t(slot) << (level * SlotBits);
+    }
+
+    void link(TimerID id) {
+        Timer   &timer = _timers[id];
+        uint64_t time  = std::max(timer.time, _now);
+        int      level = time == _now ? 0 : (std::bit_width(time ^ _now) - 1) / SlotBits;
+        int      slot  = digitOf(time, level);
+        timer.slot     = uint16_t(level * NumSlots + slot);
+        timer.prev     = NoTimer;
+        timer.next     = _slots[timer.slot];
+        if (timer.next != NoTimer) _timers[timer.next].prev = id;
+        _slots[timer.slot] = id;
+        _occupied[level] |= uint64_t(1) << slot;
+    }
+
+    void unlink(TimerID id) {
+        Timer &timer = _timers[id];
+        if (timer.next != NoTimer) _timers[timer.next].prev = timer.prev;
+        if (timer.prev != NoTimer) {
+            _timers[timer.prev].next = timer.next;
+        } else if ((_slots[timer.slot] = timer.next) == NoTimer) {
+            _occupied[timer.slot / NumSlots] &= ~(uint64_t(1) << (timer.slot % NumSlots));
+        }
+    }
+
+    void release(TimerID id) {
+        _timers[id].next = _freeList;
+        _freeList        = id;
+        --_size;
+    }
+};
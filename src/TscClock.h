@@ -0,0 +1,37 @@
+#pragma once
+#include <chrono>
+#include <thread>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#endif
+
+/// TscClock reads the CPU timestamp counter where available, else steady_clock in nanoseconds.
+/// Ticks are converted to nanoseconds with a ratio calibrated once against steady_clock.
+struct TscClock {
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    /// calibrated on first call (sleeps ~10ms).
+    static double ticksPerNano() {
+        static const double ratio = [] {
+            auto     start      = std::chrono::steady_clock::now();
+            uint64_t startTicks = now();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            uint64_t ticks = now() - startTicks;
+            auto     nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            return nanos > 0 ? double(ticks) / double(nanos) : 1.0;
+        }();
+        return ratio;
+    }
+
+    static double toNanos(uint64_t ticks) { return double(ticks) / ticksPerNano(); }
+};
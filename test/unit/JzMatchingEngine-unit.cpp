@@ -3,6 +3,16 @@
 #endif
 #include "UnitTest.h"
 #include <OrderBook.h>
+#include <Journal.h>
+#include <Snapshot.h>
+#include <RequestParser.h>
+#include <LatencyHistogram.h>
+#include <TimingWheel.h>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <map>
+#include <random>
 
 TEST_CASE("OrderBook-Match") {
     EventDetailPrinter            reporter;
@@ -36,4 +46,1161 @@ TEST_CASE("OrderBook-Match") {
     CHECK_EQ(0, orderBook.countPriceLevels(Side::Buy));
     CHECK_EQ(1, orderBook.countOrders(Side::Sell));
     CHECK_EQ(1, orderBook.countPriceLevels(Side::Sell));
-}
\ No newline at end of file
+}
+
+TEST_CASE("OrderBook-Amend") {
+    EventDetailPrinter            reporter;
+    OrderBook<EventDetailPrinter> orderBook{reporter};
+    orderBook.matchAddNewOrder(OrderID{1}, Side::Buy, Qty{100}, CentPrice{3000});
+    orderBook.matchAddNewOrder(OrderID{2}, Side::Buy, Qty{200}, CentPrice{3000});
+    orderBook.matchAddNewOrder(OrderID{3}, Side::Buy, Qty{300}, CentPrice{2900});
+
+    // qty down keeps priority: order 1 is still first at 3000.
+    CHECK(orderBook.amendOrder(OrderID{1}, Qty{50}, CentPrice{3000}));
+    orderBook.matchAddNewOrder(OrderID{10}, Side::Sell, Qty{10}, CentPrice{3000});
+    REQUIRE_EQ(1, reporter.lastTrades.size());
+    CHECK_EQ(OrderID{1}, reporter.lastTrades.back().restingOrderFill.orderID);
+    CHECK_EQ(Qty{40}, reporter.lastTrades.back().restingOrderFill.leaveQty);
+
+    // qty up loses priority: order 2 is first now.
+    CHECK(orderBook.amendOrder(OrderID{1}, Qty{60}, CentPrice{3000}));
+    orderBook.matchAddNewOrder(OrderID{11}, Side::Sell, Qty{10}, CentPrice{3000});
+    CHECK_EQ(OrderID{2}, reporter.lastTrades.back().restingOrderFill.orderID);
+
+    // price change moves order 3 to 3000 and the empty level is released.
+    CHECK(orderBook.amendOrder(OrderID{3}, Qty{300}, CentPrice{3000}));
+    CHECK_EQ(1, orderBook.countPriceLevels(Side::Buy));
+    CHECK_EQ(3, orderBook.countOrdersAtPrice(Side::Buy, CentPrice{3000}));
+
+    // change orderID only: same node, rekeyed.
+    CHECK(orderBook.amendOrder(OrderID{2}, OrderID{20}, Qty{190}, CentPrice{3000}));
+    CHECK_FALSE(orderBook.cancelOrder(OrderID{2}));
+    CHECK_FALSE(orderBook.amendOrder(OrderID{20}, OrderID{1}, Qty{10}, CentPrice{3000})); // duplicate
+    CHECK_FALSE(orderBook.amendOrder(OrderID{20}, Qty{0}, CentPrice{3000}));
+
+    // price change that crosses trades first, then rests the remaining.
+    orderBook.matchAddNewOrder(OrderID{30}, Side::Sell, Qty{100}, CentPrice{3100});
+    CHECK(orderBook.amendOrder(OrderID{20}, OrderID{21}, Qty{190}, CentPrice{3100}));
+    CHECK_EQ(OrderID{21}, reporter.lastTrades.back().aggressiveOrderFill.orderID);
+    CHECK_EQ(Qty{90}, reporter.lastTrades.back().aggressiveOrderFill.leaveQty);
+    CHECK_EQ(0, orderBook.countOrders(Side::Sell));
+    CHECK_EQ(1, orderBook.countOrdersAtPrice(Side::Buy, CentPrice{3100}));
+    CHECK_EQ(2, orderBook.countOrdersAtPrice(Side::Buy, CentPrice{3000}));
+
+    // replace keeps the same semantics with a new orderID.
+    CHECK(orderBook.replaceOrder(OrderID{21}, OrderID{22}, Qty{50}, CentPrice{3100}));
+    CHECK_EQ(1, orderBook.countOrdersAtPrice(Side::Buy, CentPrice{3100}));
+    CHECK_FALSE(orderBook.replaceOrder(OrderID{22}, OrderID{22}, Qty{50}, CentPrice{3100}));
+    CHECK_FALSE(orderBook.replaceOrder(OrderID{99}, OrderID{98}, Qty{50}, CentPrice{3100}));
+}
+
+
+TEST_CASE("Journal-Recover") {
+    std::string path = (std::filesystem::temp_directory_path() / "JzMatchingEngine-unit.journal").string();
+    std::filesystem::remove(path);
+    {
+        JournalWriter journal;
+        REQUIRE(journal.open(path, JournalConfig{.groupCommitRecords = 2, .preallocateBytes = 4096}));
+        journal.append(OrderRequest{.orderID = 1, .qty = 100, .price = 3000, .msgType = MsgType::AddOrderRequest, .side = Side::Buy});
+        journal.append(OrderRequest{.orderID = 2, .qty = 200, .price = 2900, .msgType = MsgType::AddOrderRequest, .side = Side::Buy});
+        journal.append(OrderRequest{.orderID = 3, .qty = 50, .price = 2900, .msgType = MsgType::AddOrderRequest, .side = Side::Sell});
+        CHECK_EQ(1, journal.stats().nFlushes); // the 3rd record is flushed on close.
+    }
+    EventDetailPrinter            reporter;
+    OrderBook<EventDetailPrinter> orderBook{reporter};
+    JournalScanResult             res = replayJournal(path, std::span(&orderBook, 1));
+    CHECK(res.ok);
+    CHECK_EQ(3, res.nRecords);
+    CHECK_EQ(3, res.lastSeq);
+    CHECK_EQ(2, orderBook.countOrders(Side::Buy));
+    CHECK_EQ(50, reporter.lastTrades.back().restingOrderFill.leaveQty);
+
+    // resume appending, then corrupt the last record: replay stops before it.
+    {
+        JournalWriter journal;
+        REQUIRE(journal.open(path, JournalConfig{.groupCommitRecords = 1, .preallocateBytes = 4096}, res));
+        CHECK_EQ(4, journal.nextSeq());
+        journal.append(OrderRequest{.orderID = 1, .msgType = MsgType::CancelOrderRequest});
+        journal.append(OrderRequest{.orderID = 2, .msgType = MsgType::CancelOrderRequest});
+    }
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(res.endOffset + sizeof(JournalRecord) + offsetof(JournalRecord, request));
+        file.put('x');
+    }
+    res = scanJournal(path, [](const JournalRecord &) {});
+    CHECK_EQ(4, res.nRecords);
+
+    // a file that isn't a journal is never truncated.
+    std::ofstream{path, std::ios::trunc} << "0,1,0,100,30\n";
+    res = scanJournal(path, [](const JournalRecord &) {});
+    CHECK_FALSE(res.ok);
+    CHECK(res.notJournal);
+    JournalWriter journal;
+    CHECK_FALSE(journal.open(path, JournalConfig{}, res));
+    CHECK_FALSE(journal.isOpen());
+    CHECK_EQ(13, std::filesystem::file_size(path));
+    std::filesystem::remove(path);
+}
+
+
+TEST_CASE("OrderBook-Snapshot") {
+    EventDetailPrinter            reporter;
+    OrderBook<EventDetailPrinter> orderBook{reporter};
+    orderBook.matchAddNewOrder(OrderID{1}, Side::Buy, Qty{100}, CentPrice{2900});
+    orderBook.matchAddNewOrder(OrderID{2}, Side::Buy, Qty{200}, CentPrice{3000});
+    orderBook.matchAddNewOrder(OrderID{3}, Side::Buy, Qty{300}, CentPrice{3000});
+    orderBook.matchAddNewOrder(OrderID{4}, Side::Buy, Qty{400}, CentPrice{2800});
+    orderBook.matchAddSessionOrder(OrderID{5}, Side::Sell, Qty{500}, CentPrice{3100}, SessionID{1});
+    orderBook.cancelOrder(OrderID{1}); // removes level 2900
+
+    BookSnapshot snapshot;
+    orderBook.takeSnapshot(snapshot);
+    REQUIRE_EQ(2, snapshot.levels[0].size());
+    CHECK_EQ(CentPrice{3000}, snapshot.levels[0][0].price);
+    CHECK_EQ(2, snapshot.levels[0][0].nOrders);
+    CHECK_EQ(CentPrice{2800}, snapshot.levels[0][1].price);
+    CHECK_EQ(OrderID{2}, snapshot.orders[0][0].orderID);
+    CHECK_EQ(OrderID{3}, snapshot.orders[0][1].orderID);
+
+    std::stringstream ss;
+    REQUIRE(writeSnapshot(ss, snapshot));
+    BookSnapshot loaded;
+    std::string  bytes = ss.str();
+    REQUIRE(readSnapshot(ss, loaded));
+
+    // a truncated snapshot, or a corrupted count, is a bad format rather than a huge allocation.
+    BookSnapshot       bad;
+    std::istringstream truncated{bytes.substr(0, bytes.size() - 1)};
+    CHECK_FALSE(readSnapshot(truncated, bad));
+    std::string corrupted = bytes;
+    uint64_t    nLevels   = uint64_t(1) << 60; // buy side
+    std::memcpy(corrupted.data() + sizeof(SnapshotMagic) + sizeof(uint64_t), &nLevels, sizeof(nLevels));
+    std::istringstream corruptedStream{corrupted};
+    CHECK_FALSE(readSnapshot(corruptedStream, bad));
+
+    OrderBook<EventDetailPrinter> restored{reporter};
+    REQUIRE(restored.restoreSnapshot(loaded));
+    CHECK_FALSE(restored.restoreSnapshot(loaded)); // not empty
+    CHECK_EQ(3, restored.countOrders(Side::Buy));
+    CHECK_EQ(2, restored.countPriceLevels(Side::Buy));
+    CHECK_EQ(1, restored.countOrders(Side::Sell));
+    CHECK_EQ(0, restored.cancelSession(SessionID{1})); // session membership isn't in snapshots.
+
+    // priority is kept: order 2 then 3 at 3000, then 4 at 2800.
+    restored.matchAddNewOrder(OrderID{6}, Side::Sell, Qty{600}, CentPrice{2800});
+    REQUIRE_EQ(3, reporter.lastTrades.size());
+    CHECK_EQ(OrderID{2}, reporter.lastTrades[0].restingOrderFill.orderID);
+    CHECK_EQ(OrderID{3}, reporter.lastTrades[1].restingOrderFill.orderID);
+    CHECK_EQ(OrderID{4}, reporter.lastTrades[2].restingOrderFill.orderID);
+    CHECK(restored.cancelOrder(OrderID{4}));
+    CHECK(restored.cancelOrder(OrderID{5}));
+}
+
+TEST_CASE("OrderBook-Stats") {
+    EventDetailPrinter            reporter;
+    OrderBook<EventDetailPrinter> orderBook{reporter};
+    orderBook.matchAddNewOrder(OrderID{1}, Side::Buy, Qty{100}, CentPrice{3000});
+    orderBook.matchAddNewOrder(OrderID{2}, Side::Buy, Qty{100}, CentPrice{3000});
+    orderBook.matchAddNewOrder(OrderID{3}, Side::Buy, Qty{100}, CentPrice{2900});
+    orderBook.matchAddNewOrder(OrderID{4}, Side::Buy, Qty{100}, CentPrice{2800});
+    orderBook.cancelOrder(OrderID{3});                                             // level 2900 is removed
+    orderBook.matchAddNewOrder(OrderID{5}, Side::Sell, Qty{150}, CentPrice{3000}); // 2 fills
+
+    BookStats stats;
+    orderBook.getStats(stats);
+    const SideBookStats &buy = stats.sides[0];
+    CHECK_EQ(4, buy.nAdds);
+    CHECK_EQ(1, buy.nCancels);
+    CHECK_EQ(2, buy.nFills);
+    CHECK_EQ(3, buy.nLevelsCreated);
+    CHECK_EQ(1, buy.nLevelsDestroyed);
+    CHECK_EQ(2, buy.nOrders);
+    CHECK_EQ(2, buy.nPriceLevels);
+    CHECK_EQ(3, buy.maxPriceLevels);
+    CHECK_EQ(2, buy.maxOrdersPerLevel);
+    CHECK_EQ(0, stats.sides[1].nAdds);
+    CHECK_EQ(2, stats.nOrderIDs);
+    CHECK_GE(stats.orderIDMeanProbeLength, 1.0);
+    CHECK_GE(stats.orderIDMaxProbeLength, 1);
+
+    orderBook.matchAddNewOrder(OrderID{6}, Side::Sell, Qty{150}, CentPrice{2800}); // sweeps 3000 and 2800
+    orderBook.getStats(stats);
+    CHECK_EQ(3, stats.sides[0].nLevelsDestroyed);
+    CHECK_EQ(0, stats.nOrderIDs);
+}
+
+TEST_CASE("OrderBook-Depth") {
+    EventDetailPrinter            reporter;
+    OrderBook<EventDetailPrinter> orderBook{reporter};
+    orderBook.matchAddNewOrder(OrderID{1}, Side::Buy, Qty{100}, CentPrice{2900});
+    orderBook.matchAddNewOrder(OrderID{2}, Side::Buy, Qty{200}, CentPrice{3000});
+    orderBook.matchAddNewOrder(OrderID{3}, Side::Buy, Qty{300}, CentPrice{3000});
+    orderBook.matchAddNewOrder(OrderID{4}, Side::Buy, Qty{400}, CentPrice{2800});
+    orderBook.matchAddNewOrder(OrderID{5}, Side::Sell, Qty{500}, CentPrice{3200});
+    orderBook.matchAddNewOrder(OrderID{6}, Side::Sell, Qty{600}, CentPrice{3100});
+
+    TopOfBook top = orderBook.topOfBook();
+    CHECK_EQ(CentPrice{3000}, top.bid.price);
+    CHECK_EQ(500, top.bid.totalQty);
+    CHECK_EQ(2, top.bid.nOrders);
+    CHECK_EQ(CentPrice{3100}, top.ask.price);
+    CHECK_EQ(600, top.ask.totalQty);
+
+    std::array<DepthLevel, 4> levels;
+    REQUIRE_EQ(3, orderBook.depth(Side::Buy, 10, levels));
+    CHECK_EQ(CentPrice{3000}, levels[0].price);
+    CHECK_EQ(CentPrice{2900}, levels[1].price);
+    CHECK_EQ(CentPrice{2800}, levels[2].price);
+    CHECK_EQ(400, levels[2].totalQty);
+    CHECK_EQ(1, orderBook.depth(Side::Sell, 1, levels));
+
+    // aggregates follow fills, partial cancels, amends and cancels.
+    orderBook.matchAddNewOrder(OrderID{7}, Side::Sell, Qty{250}, CentPrice{3000}); // fills 2, 50 of 3
+    orderBook.partialCancelOrder(OrderID{3}, 50);
+    orderBook.amendOrder(OrderID{1}, Qty{150}, CentPrice{2900});
+    orderBook.cancelOrder(OrderID{4});
+    REQUIRE_EQ(2, orderBook.depth(Side::Buy, 10, levels));
+    CHECK_EQ(200, levels[0].totalQty);
+    CHECK_EQ(1, levels[0].nOrders);
+    CHECK_EQ(150, levels[1].totalQty);
+
+    orderBook.amendOrder(OrderID{3}, Qty{200}, CentPrice{2900}); // moves to level 2900
+    top = orderBook.topOfBook();
+    CHECK_EQ(CentPrice{2900}, top.bid.price);
+    CHECK_EQ(350, top.bid.totalQty);
+    CHECK_EQ(2, top.bid.nOrders);
+    CHECK_EQ(1, orderBook.countPriceLevels(Side::Buy));
+
+    orderBook.cancelOrder(OrderID{5});
+    orderBook.cancelOrder(OrderID{6});
+    CHECK_EQ(0, orderBook.topOfBook().ask.nOrders);
+}
+
+/// MarketDataRecorder rebuilds both sides of a book from L2 updates and L3 events.
+struct MarketDataRecorder : EventDetailPrinter {
+    struct RestingOrder {
+        Side      side;
+        CentPrice price;
+        Qty       qty;
+    };
+    std::array<std::map<CentPrice, DepthLevel>, 2> levels;
+    std::map<OrderID, RestingOrder>                orders;
+    bool                                           consistent = true;
+
+    void onLevelUpdate(const LevelUpdateMsg &msg) {
+        auto &sideLevels = levels[int(msg.side)];
+        bool  exists     = sideLevels.contains(msg.price);
+        consistent       = consistent && exists == (msg.type != LevelUpdateMsg::New);
+        if (msg.type == LevelUpdateMsg::Delete) sideLevels.erase(msg.price);
+        else sideLevels[msg.price] = DepthLevel{.price = msg.price, .totalQty = msg.totalQty, .nOrders = msg.nOrders};
+    }
+    void onOrderEvent(const OrderEventMsg &msg) {
+        if (msg.type == OrderEventMsg::Add) {
+            consistent = consistent && !orders.contains(msg.orderID);
+        } else {
+            consistent = consistent && orders.contains(msg.origOrderID);
+            orders.erase(msg.origOrderID);
+        }
+        if (msg.leaveQty > 0) orders[msg.orderID] = RestingOrder{.side = msg.side, .price = msg.price, .qty = msg.leaveQty};
+    }
+};
+static_assert(MarketDataReporter<MarketDataRecorder>, "MarketDataRecorder Impl MarketDataReporter");
+
+TEST_CASE("OrderBook-MarketData") {
+    std::ostringstream            events;
+    MarketDataRecorder            recorder{{.ostream = events, .estream = events}};
+    OrderBook<MarketDataRecorder> orderBook{recorder};
+    std::mt19937                  rng(7);
+    std::vector<OrderID>          ids;
+    OrderID                       nextID = 1;
+    for (int i = 0; i < 5000; ++i) {
+        unsigned  action = rng() % 10;
+        Side      side   = rng() % 2 ? Side::Sell : Side::Buy;
+        CentPrice price  = CentPrice(1000 + rng() % 20);
+        Qty       qty    = Qty(1 + rng() % 100);
+        if (action < 5 || ids.empty()) {
+            orderBook.matchAddNewOrder(nextID, side, qty, price);
+            ids.push_back(nextID++);
+        } else {
+            OrderID id = ids[rng() % ids.size()];
+            if (action < 7) orderBook.cancelOrder(id);
+            else if (action < 8) orderBook.partialCancelOrder(id, Qty(rng() % 20));
+            else if (action < 9) orderBook.amendOrder(id, qty, price);
+            else if (orderBook.replaceOrder(id, nextID, qty, price)) ids.push_back(nextID++);
+        }
+        if (i % 100) continue;
+        // compare the rebuilt book with the book.
+        REQUIRE(recorder.consistent);
+        std::array<DepthLevel, 32> depth;
+        for (Side s : {Side::Buy, Side::Sell}) {
+            size_t n = orderBook.depth(s, depth.size(), depth);
+            REQUIRE_EQ(n, recorder.levels[int(s)].size());
+            for (size_t k = 0; k < n; ++k) {
+                const DepthLevel &rebuilt = recorder.levels[int(s)][depth[k].price];
+                CHECK_EQ(depth[k].totalQty, rebuilt.totalQty);
+                CHECK_EQ(depth[k].nOrders, rebuilt.nOrders);
+            }
+        }
+        BookSnapshot snapshot;
+        orderBook.takeSnapshot(snapshot);
+        REQUIRE_EQ(snapshot.orders[0].size() + snapshot.orders[1].size(), recorder.orders.size());
+        for (int s = 0; s < 2; ++s) {
+            auto iterOrder = snapshot.orders[s].begin();
+            for (const internal::SnapshotLevel &level : snapshot.levels[s]) {
+                for (uint32_t k = 0; k < level.nOrders; ++k, ++iterOrder) {
+                    auto it = recorder.orders.find(iterOrder->orderID);
+                    REQUIRE(it != recorder.orders.end());
+                    CHECK_EQ(iterOrder->qty, it->second.qty);
+                    CHECK_EQ(level.price, it->second.price);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("OrderBook-BBO") {
+    struct BBORecorder : EventDetailPrinter {
+        std::vector<TopOfBook> updates;
+        void                   onBBO(const TopOfBook &bbo) { updates.push_back(bbo); }
+    };
+    static_assert(BBOReporter<BBORecorder>, "BBORecorder Impl BBOReporter");
+
+    BBORecorder            reporter;
+    OrderBook<BBORecorder> orderBook{reporter};
+    orderBook.matchAddNewOrder(OrderID{1}, Side::Buy, Qty{100}, CentPrice{3000});
+    REQUIRE_EQ(1, reporter.updates.size());
+    CHECK_EQ(CentPrice{3000}, reporter.updates.back().bid.price);
+    CHECK_EQ(100, reporter.updates.back().bid.totalQty);
+    CHECK_EQ(0, reporter.updates.back().ask.nOrders);
+
+    orderBook.matchAddNewOrder(OrderID{2}, Side::Buy, Qty{100}, CentPrice{2900}); // behind the top
+    CHECK_EQ(1, reporter.updates.size());
+    CHECK_FALSE(orderBook.cancelOrder(OrderID{9})); // rejected
+    CHECK_EQ(1, reporter.updates.size());
+
+    orderBook.matchAddNewOrder(OrderID{3}, Side::Buy, Qty{100}, CentPrice{3000}); // qty & order count at the top change
+    REQUIRE_EQ(2, reporter.updates.size());
+    CHECK_EQ(200, reporter.updates.back().bid.totalQty);
+    CHECK_EQ(2, reporter.updates.back().bid.nOrders);
+
+    // a sweep through 2 levels gives one update.
+    orderBook.matchAddNewOrder(OrderID{4}, Side::Sell, Qty{350}, CentPrice{2900});
+    REQUIRE_EQ(3, reporter.updates.size());
+    CHECK_EQ(0, reporter.updates.back().bid.nOrders);
+    CHECK_EQ(CentPrice{2900}, reporter.updates.back().ask.price);
+    CHECK_EQ(50, reporter.updates.back().ask.totalQty);
+
+    // a batch gives at most one update.
+    orderBook.beginBatch();
+    orderBook.matchAddNewOrder(OrderID{5}, Side::Buy, Qty{10}, CentPrice{2800});
+    orderBook.matchAddNewOrder(OrderID{6}, Side::Sell, Qty{10}, CentPrice{2850});
+    orderBook.cancelOrder(OrderID{4});
+    CHECK_EQ(3, reporter.updates.size());
+    orderBook.endBatch();
+    REQUIRE_EQ(4, reporter.updates.size());
+    CHECK_EQ(CentPrice{2800}, reporter.updates.back().bid.price);
+    CHECK_EQ(CentPrice{2850}, reporter.updates.back().ask.price);
+
+    orderBook.beginBatch(); // no change, no update.
+    orderBook.matchAddNewOrder(OrderID{7}, Side::Sell, Qty{10}, CentPrice{2900});
+    orderBook.cancelOrder(OrderID{7});
+    orderBook.endBatch();
+    CHECK_EQ(4, reporter.updates.size());
+}
+
+TEST_CASE("OrderBook-BulkLoad") {
+    auto checkSameBook = [](auto &book, auto &expected) {
+        BookSnapshot snapshot, expectedSnapshot;
+        book.takeSnapshot(snapshot);
+        expected.takeSnapshot(expectedSnapshot);
+        for (int s = 0; s < 2; ++s) {
+            REQUIRE_EQ(expectedSnapshot.orders[s].size(), snapshot.orders[s].size());
+            REQUIRE_EQ(expectedSnapshot.levels[s].size(), snapshot.levels[s].size());
+            for (size_t k = 0; k < snapshot.levels[s].size(); ++k) {
+                CHECK_EQ(expectedSnapshot.levels[s][k].price, snapshot.levels[s][k].price);
+                CHECK_EQ(expectedSnapshot.levels[s][k].nOrders, snapshot.levels[s][k].nOrders);
+            }
+            for (size_t k = 0; k < snapshot.orders[s].size(); ++k) {
+                CHECK_EQ(expectedSnapshot.orders[s][k].orderID, snapshot.orders[s][k].orderID);
+                CHECK_EQ(expectedSnapshot.orders[s][k].qty, snapshot.orders[s][k].qty);
+            }
+        }
+    };
+
+    std::ostringstream events;
+    SUBCASE("reject") {
+        MarketDataRecorder            reporter{{.ostream = events, .estream = events}};
+        OrderBook<MarketDataRecorder> orderBook{reporter};
+        orderBook.matchAddNewOrder(OrderID{1}, Side::Sell, Qty{100}, CentPrice{3100});
+        std::vector<BulkOrder> orders = {
+                {.orderID = 2, .side = Side::Buy, .qty = 100, .price = 2900},
+                {.orderID = 3, .side = Side::Buy, .qty = 200, .price = 3000},
+                {.orderID = 4, .side = Side::Sell, .qty = 300, .price = 3000}, // crosses order 3
+                {.orderID = 5, .side = Side::Buy, .qty = 400, .price = 3000},
+                {.orderID = 6, .side = Side::Buy, .qty = 400, .price = 3100}, // crosses order 1
+                {.orderID = 2, .side = Side::Sell, .qty = 100, .price = 3200}, // duplicate
+                {.orderID = 7, .side = Side::Sell, .qty = 0, .price = 3200},
+                {.orderID = 8, .side = Side::Sell, .qty = 100, .price = 3200},
+        };
+        CHECK_EQ(4, orderBook.bulkLoad(orders));
+        CHECK_EQ(3, orderBook.countOrders(Side::Buy));
+        CHECK_EQ(2, orderBook.countOrders(Side::Sell));
+        CHECK_EQ(2, orderBook.countOrdersAtPrice(Side::Buy, CentPrice{3000}));
+        CHECK_NE(std::string::npos, events.str().find("CrossesBook"));
+        CHECK(reporter.consistent);
+        CHECK_EQ(5, reporter.orders.size());
+        CHECK_EQ(2, reporter.levels[0].size());
+        CHECK_EQ(2, reporter.levels[1].size());
+
+        // priority: 3000 before 2900, order 3 before 5.
+        orderBook.matchAddNewOrder(OrderID{9}, Side::Sell, Qty{700}, CentPrice{2900});
+        REQUIRE_EQ(3, reporter.lastTrades.size());
+        CHECK_EQ(OrderID{3}, reporter.lastTrades[0].restingOrderFill.orderID);
+        CHECK_EQ(OrderID{5}, reporter.lastTrades[1].restingOrderFill.orderID);
+        CHECK_EQ(OrderID{2}, reporter.lastTrades[2].restingOrderFill.orderID);
+        CHECK(orderBook.cancelOrder(OrderID{8}));
+    }
+    SUBCASE("same as one by one") {
+        EventDetailPrinter            reporter{.ostream = events, .estream = events};
+        OrderBook<EventDetailPrinter> orderBook{reporter}, expected{reporter};
+        std::mt19937                  rng(11);
+        std::vector<BulkOrder>        orders;
+        for (OrderID id = 1; id <= 3000; ++id) {
+            Side side = rng() % 2 ? Side::Sell : Side::Buy;
+            orders.push_back({.orderID = id, .side = side, .qty = Qty(1 + rng() % 100), .price = CentPrice(1000 + rng() % 40)});
+        }
+        CHECK_EQ(orders.size(), orderBook.bulkLoad(orders, BulkCrossing::Match));
+        for (const BulkOrder &order : orders) expected.matchAddNewOrder(order.orderID, order.side, order.qty, order.price);
+        checkSameBook(orderBook, expected);
+
+        // presorted input into a non-empty book.
+        std::vector<BulkOrder> sorted;
+        for (OrderID id = 5000; id < 5100; ++id) sorted.push_back({.orderID = id, .side = Side::Buy, .qty = 10, .price = CentPrice(900 - id % 50)});
+        std::stable_sort(sorted.begin(), sorted.end(), [](auto &x, auto &y) { return x.price > y.price; });
+        CHECK_EQ(sorted.size(), orderBook.bulkLoad(sorted));
+        for (const BulkOrder &order : sorted) expected.matchAddNewOrder(order.orderID, order.side, order.qty, order.price);
+        checkSameBook(orderBook, expected);
+    }
+}
+
+TEST_CASE("OrderBook-MassCancel") {
+    struct MassCancelRecorder : MarketDataRecorder {
+        std::vector<MassCancelMsg> summaries;
+        void                       onMassCancel(const MassCancelMsg &msg) { summaries.push_back(msg); }
+    };
+    static_assert(MassCancelReporter<MassCancelRecorder>, "MassCancelRecorder Impl MassCancelReporter");
+
+    std::ostringstream            events;
+    MassCancelRecorder            recorder{{{.ostream = events, .estream = events}}};
+    OrderBook<MassCancelRecorder> orderBook{recorder};
+    for (OrderID id = 1; id <= 100; ++id) { // buy 1000..1009, sell 1010..1019, 5 orders each.
+        Side side = id % 2 ? Side::Sell : Side::Buy;
+        orderBook.matchAddNewOrder(id, side, Qty(id), CentPrice(1000 + (side == Side::Sell ? 10 : 0) + id / 2 % 10));
+    }
+    REQUIRE_EQ(50, orderBook.countOrders(Side::Buy));
+
+    // per order events.
+    CHECK_EQ(15, orderBook.cancelPriceRange(Side::Buy, CentPrice{1002}, CentPrice{1004}));
+    CHECK(recorder.consistent);
+    CHECK_EQ(35, orderBook.countOrders(Side::Buy));
+    CHECK_EQ(7, orderBook.countPriceLevels(Side::Buy));
+    CHECK_EQ(0, orderBook.countOrdersAtPrice(Side::Buy, CentPrice{1003}));
+    CHECK_EQ(5, orderBook.countOrdersAtPrice(Side::Buy, CentPrice{1005}));
+    CHECK_EQ(85, recorder.orders.size());
+    CHECK_EQ(7, recorder.levels[0].size());
+    CHECK_FALSE(orderBook.cancelOrder(OrderID{6})); // 1003, cancelled
+    CHECK(orderBook.cancelOrder(OrderID{10}));      // 1005
+    CHECK_EQ(0, orderBook.cancelPriceRange(Side::Buy, CentPrice{1004}, CentPrice{1002}));
+    CHECK(recorder.summaries.empty());
+
+    // a summary event.
+    CHECK_EQ(50, orderBook.cancelSide(Side::Sell, CancelReport::Summary));
+    REQUIRE_EQ(1, recorder.summaries.size());
+    CHECK_EQ(MassCancelMsg::OneSide, recorder.summaries[0].scope);
+    CHECK_EQ(50, recorder.summaries[0].nOrders);
+    CHECK_EQ(10, recorder.summaries[0].nLevels);
+    CHECK_EQ(0, orderBook.countOrders(Side::Sell));
+    CHECK_EQ(0, orderBook.topOfBook().ask.nOrders);
+    CHECK_FALSE(orderBook.cancelOrder(OrderID{1}));
+
+    CHECK_EQ(34, orderBook.cancelAll());
+    CHECK(recorder.consistent);
+    CHECK(recorder.levels[0].empty());
+    CHECK_EQ(0, orderBook.countOrders(Side::Buy));
+    BookStats stats;
+    orderBook.getStats(stats);
+    CHECK_EQ(0, stats.nOrderIDs);
+    CHECK_EQ(100, stats.sides[0].nCancels + stats.sides[1].nCancels);
+
+    // the book is usable after a cancelAll, orderIDs can be reused.
+    orderBook.matchAddNewOrder(OrderID{1}, Side::Buy, Qty{10}, CentPrice{1000});
+    CHECK_EQ(1, orderBook.countOrders(Side::Buy));
+    CHECK(orderBook.cancelOrder(OrderID{1}));
+}
+
+TEST_CASE("OrderBook-TimeInForce") {
+    std::ostringstream            events;
+    EventDetailPrinter            reporter{.ostream = events, .estream = events};
+    OrderBook<EventDetailPrinter> orderBook{reporter};
+    orderBook.matchAddNewOrder(OrderID{1}, Side::Sell, Qty{100}, CentPrice{3000});
+    orderBook.matchAddNewOrder(OrderID{2}, Side::Sell, Qty{100}, CentPrice{3100});
+    orderBook.matchAddNewOrder(OrderID{3}, Side::Sell, Qty{100}, CentPrice{3200});
+
+    // IOC: the remaining qty doesn't rest.
+    CHECK(orderBook.matchAddNewOrder(OrderID{4}, Side::Buy, Qty{150}, CentPrice{3000}, TimeInForce::IOC));
+    REQUIRE_EQ(1, reporter.lastTrades.size());
+    CHECK_EQ(100, reporter.lastTrades[0].tradeQty);
+    CHECK_EQ(0, orderBook.countOrders(Side::Buy));
+    CHECK(orderBook.matchAddNewOrder(OrderID{5}, Side::Buy, Qty{10}, CentPrice{3000}, TimeInForce::IOC)); // nothing to match
+    CHECK_EQ(0, orderBook.countOrders(Side::Buy));
+    CHECK_EQ(2, orderBook.countOrders(Side::Sell));
+
+    // FOK: rejected without a trade if the matchable levels don't have enough qty.
+    reporter.lastTrades.clear();
+    CHECK_FALSE(orderBook.matchAddNewOrder(OrderID{6}, Side::Buy, Qty{201}, CentPrice{3200}, TimeInForce::FOK));
+    CHECK_FALSE(orderBook.matchAddNewOrder(OrderID{6}, Side::Buy, Qty{150}, CentPrice{3100}, TimeInForce::FOK));
+    CHECK_NE(std::string::npos, events.str().find("NotFillable"));
+    CHECK(reporter.lastTrades.empty());
+    CHECK_EQ(2, orderBook.countOrders(Side::Sell));
+    CHECK(orderBook.matchAddNewOrder(OrderID{6}, Side::Buy, Qty{150}, CentPrice{3200}, TimeInForce::FOK));
+    REQUIRE_EQ(2, reporter.lastTrades.size());
+    CHECK_EQ(CentPrice{3200}, reporter.lastTrades[1].tradePrice);
+    CHECK(reporter.lastTrades[1].aggressiveOrderFill.isFull);
+    CHECK_EQ(1, orderBook.countOrders(Side::Sell));
+    CHECK_EQ(0, orderBook.countOrders(Side::Buy));
+
+    // CSV: optional timeInForce field of AddOrderRequest.
+    OrderRequest req;
+    REQUIRE(parseRequestLine(0, "0,7,0,10,30.00,2", req));
+    CHECK_EQ(TimeInForce::FOK, req.timeInForce);
+    std::ostringstream csv;
+    formatRequestCSV(csv, req);
+    CHECK_EQ("0,7,0,10,30.00,2\n", csv.str());
+    REQUIRE(parseRequestLine(0, "0,7,0,10,30.00", req));
+    CHECK_EQ(TimeInForce::GTC, req.timeInForce);
+    CHECK_FALSE(parseRequestLine(0, "0,7,0,10,30.00,3", req));
+    CHECK_FALSE(parseRequestLine(0, "0,7,0,10", req));
+}
+
+TEST_CASE("OrderBook-MarketOrder") {
+    std::ostringstream            events;
+    EventDetailPrinter            reporter{.ostream = events, .estream = events};
+    OrderBook<EventDetailPrinter> orderBook{reporter};
+    for (CentPrice price : {3000, 3010, 3020, 3050}) orderBook.matchAddNewOrder(OrderID(price), Side::Sell, Qty{100}, price);
+
+    // the band stops the sweep 20 ticks from the best ask; the rest is discarded.
+    CHECK(orderBook.matchMarketOrder(OrderID{1}, Side::Buy, Qty{350}, CentPrice{20}));
+    REQUIRE_EQ(3, reporter.lastTrades.size());
+    CHECK_EQ(CentPrice{3020}, reporter.lastTrades[2].tradePrice);
+    CHECK_EQ(50, reporter.lastTrades[2].aggressiveOrderFill.leaveQty);
+    CHECK_EQ(0, orderBook.countOrders(Side::Buy));
+    CHECK_EQ(1, orderBook.countOrders(Side::Sell));
+
+    // no band: sweeps the whole side, never rests.
+    CHECK(orderBook.matchMarketOrder(OrderID{2}, Side::Buy, Qty{1000}));
+    CHECK_EQ(CentPrice{3050}, reporter.lastTrades.back().tradePrice);
+    CHECK_EQ(0, orderBook.countOrders(Side::Sell));
+    CHECK_EQ(0, orderBook.countOrders(Side::Buy));
+
+    // nothing to match.
+    reporter.lastTrades.clear();
+    CHECK(orderBook.matchMarketOrder(OrderID{3}, Side::Sell, Qty{10}, CentPrice{5}));
+    CHECK(reporter.lastTrades.empty());
+    CHECK_EQ(0, orderBook.countOrders(Side::Sell));
+
+    orderBook.matchAddNewOrder(OrderID{4}, Side::Buy, Qty{10}, CentPrice{2990});
+    CHECK(orderBook.matchMarketOrder(OrderID{5}, Side::Sell, Qty{10}, CentPrice{0}));
+    CHECK_EQ(CentPrice{2990}, reporter.lastTrades.back().tradePrice);
+    orderBook.matchAddNewOrder(OrderID{6}, Side::Buy, Qty{10}, CentPrice{2990});
+    CHECK_FALSE(orderBook.matchMarketOrder(OrderID{6}, Side::Sell, Qty{10})); // duplicate
+}
+
+TEST_CASE("OrderBook-Iceberg") {
+    std::ostringstream            events;
+    MarketDataRecorder            reporter{{.ostream = events, .estream = events}};
+    OrderBook<MarketDataRecorder> orderBook{reporter};
+    CHECK_FALSE(orderBook.matchAddIcebergOrder(OrderID{1}, Side::Sell, Qty{100}, CentPrice{3000}, Qty{0}));
+    REQUIRE(orderBook.matchAddIcebergOrder(OrderID{1}, Side::Sell, Qty{100}, CentPrice{3000}, Qty{30}));
+    orderBook.matchAddNewOrder(OrderID{2}, Side::Sell, Qty{50}, CentPrice{3000});
+    CHECK_EQ(80, orderBook.topOfBook().ask.totalQty); // only the displayed qty
+    CHECK_EQ(30, reporter.orders[1].qty);
+
+    // the displayed part fills, the next part is displayed behind order 2.
+    orderBook.matchAddNewOrder(OrderID{3}, Side::Buy, Qty{40}, CentPrice{3000});
+    REQUIRE_EQ(2, reporter.lastTrades.size());
+    CHECK_EQ(OrderID{1}, reporter.lastTrades[0].restingOrderFill.orderID);
+    CHECK_FALSE(reporter.lastTrades[0].restingOrderFill.isFull);
+    CHECK_EQ(70, reporter.lastTrades[0].restingOrderFill.leaveQty);
+    CHECK_EQ(OrderID{2}, reporter.lastTrades[1].restingOrderFill.orderID);
+    CHECK_EQ(70, orderBook.topOfBook().ask.totalQty);
+    CHECK_EQ(2, orderBook.topOfBook().ask.nOrders);
+    CHECK(reporter.consistent);
+    CHECK_EQ(30, reporter.orders[1].qty);
+    CHECK_EQ(70, reporter.levels[1][CentPrice{3000}].totalQty);
+
+    // a snapshot keeps the reserve.
+    BookSnapshot snapshot;
+    orderBook.takeSnapshot(snapshot);
+    REQUIRE_EQ(2, snapshot.orders[1].size());
+    CHECK_EQ(OrderID{1}, snapshot.orders[1][1].orderID);
+    CHECK_EQ(40, snapshot.orders[1][1].hiddenQty);
+
+    // a partial cancel takes the reserve first, then the displayed qty.
+    CHECK(orderBook.partialCancelOrder(OrderID{1}, Qty{50}));
+    CHECK_EQ(60, orderBook.topOfBook().ask.totalQty);
+    CHECK_EQ(20, reporter.orders[1].qty);
+    CHECK_FALSE(orderBook.partialCancelOrder(OrderID{1}, Qty{21}));
+
+    // one aggressive order fills the displayed parts and the reserve of each refresh.
+    orderBook.amendOrder(OrderID{1}, Qty{100}, CentPrice{3000}); // 30 displayed, 70 hidden
+    CHECK_EQ(70, orderBook.topOfBook().ask.totalQty);
+    orderBook.matchAddNewOrder(OrderID{4}, Side::Buy, Qty{140}, CentPrice{3000});
+    REQUIRE_EQ(5, reporter.lastTrades.size()); // order 2, then order 1 for 30, 30, 30, 10
+    CHECK(reporter.lastTrades[4].restingOrderFill.isFull);
+    CHECK(reporter.lastTrades[4].aggressiveOrderFill.isFull);
+    CHECK_EQ(0, orderBook.countOrders(Side::Sell));
+    CHECK(reporter.consistent);
+    CHECK(reporter.orders.empty());
+    CHECK(reporter.levels[1].empty());
+
+    OrderBook<MarketDataRecorder> restored{reporter};
+    REQUIRE(restored.restoreSnapshot(snapshot));
+    CHECK_EQ(70, restored.topOfBook().ask.totalQty);
+    restored.matchAddNewOrder(OrderID{5}, Side::Buy, Qty{110}, CentPrice{3000});
+    CHECK_EQ(0, restored.countOrders(Side::Sell));
+
+    // a fill-or-kill order counts the reserve.
+    REQUIRE(orderBook.matchAddIcebergOrder(OrderID{6}, Side::Sell, Qty{100}, CentPrice{3000}, Qty{30}));
+    CHECK_FALSE(orderBook.matchAddNewOrder(OrderID{7}, Side::Buy, Qty{101}, CentPrice{3000}, TimeInForce::FOK));
+    CHECK(orderBook.matchAddNewOrder(OrderID{7}, Side::Buy, Qty{100}, CentPrice{3000}, TimeInForce::FOK));
+    CHECK(reporter.lastTrades.back().aggressiveOrderFill.isFull);
+    CHECK_EQ(0, orderBook.countOrders(Side::Sell));
+}
+
+TEST_CASE("OrderBook-Stop") {
+    struct TradeRecorder : EventDetailPrinter {
+        std::vector<TradeMsg> trades;
+        void                  onTrade(const TradeMsg &msg) { trades.push_back(msg); }
+    };
+    std::ostringstream       events;
+    TradeRecorder            reporter{{.ostream = events, .estream = events}};
+    OrderBook<TradeRecorder> orderBook{reporter};
+    for (OrderID id = 1; id <= 4; ++id) orderBook.matchAddNewOrder(id, Side::Sell, Qty{100}, CentPrice(3000 + 10 * id));
+    orderBook.matchAddNewOrder(OrderID{5}, Side::Buy, Qty{100}, CentPrice{2990});
+    orderBook.matchAddNewOrder(OrderID{6}, Side::Buy, Qty{100}, CentPrice{2980});
+
+    CHECK(orderBook.addStopOrder(OrderID{10}, Side::Buy, Qty{100}, CentPrice{3010}));
+    CHECK(orderBook.addStopLimitOrder(OrderID{11}, Side::Buy, Qty{150}, CentPrice{3020}, CentPrice{3030}));
+    CHECK(orderBook.addStopOrder(OrderID{12}, Side::Sell, Qty{100}, CentPrice{2990}));
+    CHECK(orderBook.addStopOrder(OrderID{13}, Side::Sell, Qty{100}, CentPrice{2980}));
+    CHECK_FALSE(orderBook.addStopOrder(OrderID{10}, Side::Buy, Qty{100}, CentPrice{3010}));
+    CHECK_FALSE(orderBook.addStopOrder(OrderID{1}, Side::Buy, Qty{100}, CentPrice{3010}));
+    CHECK_FALSE(orderBook.matchAddNewOrder(OrderID{11}, Side::Buy, Qty{100}, CentPrice{2000}));
+    CHECK_FALSE(orderBook.addStopOrder(OrderID{14}, Side::Buy, Qty{0}, CentPrice{3010}));
+    CHECK(orderBook.addStopOrder(OrderID{14}, Side::Buy, Qty{10}, CentPrice{5000}));
+    CHECK(orderBook.cancelOrder(OrderID{14}));
+    CHECK_FALSE(orderBook.cancelOrder(OrderID{14}));
+    CHECK_EQ(2, orderBook.countStopOrders(Side::Buy));
+    CHECK_EQ(2, orderBook.countStopOrders(Side::Sell));
+    CHECK(reporter.trades.empty());
+
+    // a trade at 3010 releases stop 10, whose trade at 3020 releases stop-limit 11.
+    orderBook.matchAddNewOrder(OrderID{20}, Side::Buy, Qty{50}, CentPrice{3010});
+    REQUIRE_EQ(5, reporter.trades.size());
+    std::vector<std::pair<OrderID, CentPrice>> expected = {{20, 3010}, {10, 3010}, {10, 3020}, {11, 3020}, {11, 3030}};
+    for (size_t i = 0; i < expected.size(); ++i) {
+        CHECK_EQ(expected[i].first, reporter.trades[i].aggressiveOrderFill.orderID);
+        CHECK_EQ(expected[i].second, reporter.trades[i].tradePrice);
+    }
+    CHECK(reporter.trades.back().aggressiveOrderFill.isFull);
+    CHECK_EQ(0, orderBook.countStopOrders(Side::Buy));
+    CHECK_EQ(1, orderBook.countOrders(Side::Sell));
+    CHECK_EQ(2, orderBook.countOrders(Side::Buy)); // stop-limit 11 is fully filled
+
+    // sell side cascade: 12 trades through 2990 to 2980, which releases 13. Its remaining qty is discarded.
+    reporter.trades.clear();
+    orderBook.matchAddNewOrder(OrderID{21}, Side::Sell, Qty{50}, CentPrice{2990});
+    REQUIRE_EQ(4, reporter.trades.size());
+    CHECK_EQ(OrderID{12}, reporter.trades[1].aggressiveOrderFill.orderID);
+    CHECK_EQ(CentPrice{2980}, reporter.trades[2].tradePrice);
+    CHECK_EQ(OrderID{13}, reporter.trades[3].aggressiveOrderFill.orderID);
+    CHECK_EQ(50, reporter.trades[3].aggressiveOrderFill.leaveQty);
+    CHECK_EQ(0, orderBook.countOrders(Side::Buy));
+    CHECK_EQ(0, orderBook.countStopOrders(Side::Sell));
+
+    // the last trade (2980) has reached the stop price: released right away.
+    orderBook.matchAddNewOrder(OrderID{7}, Side::Buy, Qty{100}, CentPrice{2970});
+    reporter.trades.clear();
+    CHECK(orderBook.addStopLimitOrder(OrderID{15}, Side::Sell, Qty{10}, CentPrice{3000}, CentPrice{2970}));
+    REQUIRE_EQ(1, reporter.trades.size());
+    CHECK_EQ(0, orderBook.countStopOrders(Side::Sell));
+
+    CHECK(orderBook.addStopOrder(OrderID{16}, Side::Buy, Qty{10}, CentPrice{9000}));
+    CHECK_EQ(3, orderBook.cancelAll());
+    CHECK_EQ(0, orderBook.countStopOrders(Side::Buy));
+}
+
+TEST_CASE("OrderBook-PostOnly") {
+    struct AckRecorder : EventDetailPrinter {
+        std::vector<OrderAckMsg> acks;
+        void                     onOrderAck(const OrderAckMsg &msg) { acks.push_back(msg); }
+    };
+    static_assert(OrderAckReporter<AckRecorder>, "AckRecorder Impl OrderAckReporter");
+
+    std::ostringstream     events;
+    AckRecorder            reporter{{.ostream = events, .estream = events}};
+    OrderBook<AckRecorder> orderBook{reporter};
+    orderBook.matchAddNewOrder(OrderID{1}, Side::Sell, Qty{100}, CentPrice{3000});
+    orderBook.matchAddNewOrder(OrderID{2}, Side::Buy, Qty{100}, CentPrice{2990});
+
+    CHECK(orderBook.addPostOnlyOrder(OrderID{3}, Side::Buy, Qty{10}, CentPrice{2995}));
+    REQUIRE_EQ(1, reporter.acks.size());
+    CHECK_EQ(CentPrice{2995}, reporter.acks[0].price);
+    CHECK_EQ(CentPrice{2995}, orderBook.topOfBook().bid.price);
+
+    CHECK_FALSE(orderBook.addPostOnlyOrder(OrderID{4}, Side::Buy, Qty{10}, CentPrice{3000}));
+    CHECK_NE(std::string::npos, events.str().find("WouldTrade"));
+    CHECK_EQ(1, reporter.acks.size());
+    CHECK_EQ(1, orderBook.countOrders(Side::Sell));
+
+    CHECK(orderBook.addPostOnlyOrder(OrderID{4}, Side::Buy, Qty{10}, CentPrice{3005}, PostOnly::Slide));
+    CHECK(orderBook.addPostOnlyOrder(OrderID{5}, Side::Sell, Qty{10}, CentPrice{2980}, PostOnly::Slide));
+    REQUIRE_EQ(3, reporter.acks.size());
+    CHECK_EQ(CentPrice{2999}, reporter.acks[1].price);
+    CHECK_EQ(CentPrice{3005}, reporter.acks[1].requestedPrice);
+    CHECK_EQ(CentPrice{3000}, reporter.acks[2].price); // the best bid is 2999 now
+    CHECK_EQ(2, orderBook.countOrdersAtPrice(Side::Sell, CentPrice{3000}));
+    CHECK_EQ(CentPrice{2999}, orderBook.topOfBook().bid.price);
+    CHECK(reporter.lastTrades.empty());
+    CHECK_FALSE(orderBook.addPostOnlyOrder(OrderID{5}, Side::Sell, Qty{10}, CentPrice{3100})); // duplicate
+}
+
+TEST_CASE("OrderBook-SelfTrade") {
+    struct SelfTradeRecorder : MarketDataRecorder {
+        std::vector<SelfTradeMsg> selfTrades;
+        void                      onSelfTrade(const SelfTradeMsg &msg) { selfTrades.push_back(msg); }
+    };
+    static_assert(SelfTradeReporter<SelfTradeRecorder>, "SelfTradeRecorder Impl SelfTradeReporter");
+
+    std::ostringstream           events;
+    SelfTradeRecorder            r{{{.ostream = events, .estream = events}}};
+    OrderBook<SelfTradeRecorder> orderBook{r};
+    constexpr OwnerID            Firm = 7, OtherFirm = 8;
+    auto                         setUp = [&] {
+        orderBook.cancelAll();
+        r.selfTrades.clear();
+        orderBook.matchAddOwnerOrder(OrderID{1}, Side::Sell, Qty{100}, CentPrice{3000}, Firm);
+        orderBook.matchAddOwnerOrder(OrderID{2}, Side::Sell, Qty{100}, CentPrice{3000}, OtherFirm);
+        orderBook.matchAddNewOrder(OrderID{3}, Side::Sell, Qty{100}, CentPrice{3010});
+    };
+
+    SUBCASE("CancelResting") {
+        setUp();
+        orderBook.matchAddOwnerOrder(OrderID{10}, Side::Buy, Qty{150}, CentPrice{3010}, Firm);
+        REQUIRE_EQ(1, r.selfTrades.size());
+        CHECK_EQ(OrderID{1}, r.selfTrades[0].restingOrderID);
+        CHECK_EQ(Qty{100}, r.selfTrades[0].restingCancelQty);
+        CHECK_EQ(Qty{0}, r.selfTrades[0].aggressiveCancelQty);
+        CHECK_EQ(OrderID{3}, r.lastTrades.back().restingOrderFill.orderID); // order 2 is filled, order 3 partially.
+        CHECK_EQ(Qty{50}, r.lastTrades.back().tradeQty);
+        CHECK_EQ(1, orderBook.countOrders(Side::Sell));
+        CHECK_EQ(0, orderBook.countOrders(Side::Buy));
+    }
+    SUBCASE("CancelAggressive") {
+        setUp();
+        orderBook.matchAddOwnerOrder(OrderID{10}, Side::Buy, Qty{150}, CentPrice{3010}, Firm, SelfTrade::CancelAggressive);
+        REQUIRE_EQ(1, r.selfTrades.size());
+        CHECK_EQ(Qty{150}, r.selfTrades[0].aggressiveCancelQty);
+        CHECK_EQ(Qty{0}, r.selfTrades[0].restingCancelQty);
+        CHECK(r.lastTrades.empty());
+        CHECK_EQ(3, orderBook.countOrders(Side::Sell));
+        CHECK_EQ(0, orderBook.countOrders(Side::Buy));
+    }
+    SUBCASE("CancelBoth") {
+        setUp();
+        orderBook.matchAddOwnerOrder(OrderID{10}, Side::Buy, Qty{150}, CentPrice{3010}, Firm, SelfTrade::CancelBoth);
+        REQUIRE_EQ(1, r.selfTrades.size());
+        CHECK_EQ(Qty{150}, r.selfTrades[0].aggressiveCancelQty);
+        CHECK_EQ(Qty{100}, r.selfTrades[0].restingCancelQty);
+        CHECK(r.lastTrades.empty());
+        CHECK_EQ(2, orderBook.countOrders(Side::Sell));
+        CHECK_EQ(0, orderBook.countOrders(Side::Buy));
+        CHECK(r.consistent);
+    }
+    SUBCASE("Decrement") {
+        setUp();
+        orderBook.matchAddOwnerOrder(OrderID{10}, Side::Buy, Qty{40}, CentPrice{3000}, Firm, SelfTrade::Decrement);
+        REQUIRE_EQ(1, r.selfTrades.size());
+        CHECK_EQ(Qty{40}, r.selfTrades[0].aggressiveCancelQty);
+        CHECK_EQ(Qty{40}, r.selfTrades[0].restingCancelQty);
+        CHECK(r.lastTrades.empty());
+        CHECK_EQ(Qty{160}, orderBook.topOfBook().ask.totalQty);
+
+        orderBook.matchAddOwnerOrder(OrderID{11}, Side::Buy, Qty{100}, CentPrice{3000}, Firm, SelfTrade::Decrement);
+        REQUIRE_EQ(2, r.selfTrades.size());
+        CHECK_EQ(Qty{60}, r.selfTrades[1].restingCancelQty);
+        CHECK_EQ(Qty{40}, r.lastTrades.back().tradeQty); // order 1 is gone, the rest trades with order 2.
+        CHECK_EQ(OrderID{2}, r.lastTrades.back().restingOrderFill.orderID);
+        CHECK_EQ(2, orderBook.countOrders(Side::Sell));
+        CHECK(r.consistent);
+    }
+    SUBCASE("FillOrKill") {
+        setUp();
+        // order 1 would be cancelled, not traded.
+        CHECK_FALSE(orderBook.matchAddOwnerOrder(
+                OrderID{10}, Side::Buy, Qty{150}, CentPrice{3000}, Firm, SelfTrade::CancelResting, TimeInForce::FOK));
+        CHECK(r.selfTrades.empty());
+        CHECK_EQ(3, orderBook.countOrders(Side::Sell));
+        CHECK(orderBook.matchAddOwnerOrder(OrderID{10}, Side::Buy, Qty{150}, CentPrice{3010}, Firm, SelfTrade::CancelResting, TimeInForce::FOK));
+        CHECK(r.lastTrades.back().aggressiveOrderFill.isFull);
+        CHECK_EQ(1, orderBook.countOrders(Side::Sell));
+
+        // the other modes stop the aggressive order at order 1.
+        for (SelfTrade selfTrade : {SelfTrade::CancelAggressive, SelfTrade::CancelBoth, SelfTrade::Decrement}) {
+            setUp();
+            CHECK_FALSE(orderBook.matchAddOwnerOrder(OrderID{11}, Side::Buy, Qty{50}, CentPrice{3010}, Firm, selfTrade, TimeInForce::FOK));
+            CHECK(r.selfTrades.empty());
+            CHECK_EQ(3, orderBook.countOrders(Side::Sell));
+        }
+        orderBook.matchAddOwnerOrder(OrderID{12}, Side::Sell, Qty{100}, CentPrice{2990}, OtherFirm); // before order 1
+        CHECK(orderBook.matchAddOwnerOrder(
+                OrderID{13}, Side::Buy, Qty{100}, CentPrice{3010}, Firm, SelfTrade::CancelAggressive, TimeInForce::FOK));
+        CHECK(r.selfTrades.empty());
+        CHECK_EQ(3, orderBook.countOrders(Side::Sell));
+        CHECK(r.consistent);
+    }
+    SUBCASE("RestingOwnerIsKept") {
+        setUp();
+        orderBook.matchAddOwnerOrder(OrderID{10}, Side::Buy, Qty{100}, CentPrice{2990}, Firm);
+        orderBook.matchAddOwnerOrder(OrderID{11}, Side::Sell, Qty{100}, CentPrice{2990}, Firm);
+        CHECK_EQ(1, r.selfTrades.size());
+        CHECK_EQ(0, orderBook.countOrders(Side::Buy));
+        CHECK_EQ(4, orderBook.countOrders(Side::Sell));
+    }
+}
+
+TEST_CASE("OrderBook-GTT") {
+    struct ExpiryRecorder : MarketDataRecorder {
+        std::vector<ExpiryMsg> expiries;
+        void                   onExpiry(const ExpiryMsg &msg) { expiries.push_back(msg); }
+    };
+    static_assert(ExpiryReporter<ExpiryRecorder>, "ExpiryRecorder Impl ExpiryReporter");
+
+    std::ostringstream        events;
+    ExpiryRecorder            r{{{.ostream = events, .estream = events}}};
+    OrderBook<ExpiryRecorder> orderBook{r};
+    CHECK_EQ(0, orderBook.advanceTime(1000));
+    CHECK_FALSE(orderBook.matchAddGTTOrder(OrderID{1}, Side::Buy, Qty{100}, CentPrice{3000}, 1000));
+    CHECK_NE(std::string::npos, events.str().find("Expired"));
+
+    CHECK(orderBook.matchAddGTTOrder(OrderID{1}, Side::Buy, Qty{100}, CentPrice{3000}, 2000));
+    CHECK(orderBook.matchAddGTTOrder(OrderID{2}, Side::Buy, Qty{100}, CentPrice{2990}, 5000));
+    CHECK(orderBook.matchAddGTTOrder(OrderID{3}, Side::Buy, Qty{100}, CentPrice{2980}, 2000));
+    CHECK(orderBook.matchAddGTTOrder(OrderID{4}, Side::Buy, Qty{100}, CentPrice{2970}, 1'000'000'000));
+    orderBook.matchAddNewOrder(OrderID{5}, Side::Buy, Qty{100}, CentPrice{2960});
+    orderBook.matchAddNewOrder(OrderID{6}, Side::Sell, Qty{100}, CentPrice{2980}); // fills order 1, its timer is stale.
+    orderBook.cancelOrder(OrderID{3});
+    orderBook.matchAddNewOrder(OrderID{1}, Side::Buy, Qty{100}, CentPrice{2950}); // reuses the filled orderID without expiry.
+    orderBook.replaceOrder(OrderID{2}, OrderID{7}, Qty{50}, CentPrice{2990});     // the expiry follows the new orderID.
+
+    CHECK_EQ(0, orderBook.advanceTime(4999));
+    CHECK_EQ(4, orderBook.countOrders(Side::Buy));
+    CHECK_EQ(1, orderBook.advanceTime(5000));
+    REQUIRE_EQ(1, r.expiries.size());
+    CHECK_EQ(OrderID{7}, r.expiries[0].orderID);
+    CHECK_EQ(Qty{50}, r.expiries[0].qty);
+    CHECK_EQ(CentPrice{2990}, r.expiries[0].price);
+    CHECK_EQ(Timestamp{5000}, r.expiries[0].expireTime);
+    CHECK_EQ(3, orderBook.countOrders(Side::Buy));
+    CHECK_FALSE(r.orders.contains(7));
+
+    CHECK_EQ(0, orderBook.advanceTime(4000)); // time doesn't go backwards
+    CHECK_EQ(Timestamp{5000}, orderBook.currentTime());
+    CHECK_EQ(1, orderBook.advanceTime(2'000'000'000));
+    CHECK_EQ(OrderID{4}, r.expiries[1].orderID);
+    CHECK_EQ(2, orderBook.countOrders(Side::Buy));
+    CHECK(r.consistent);
+}
+
+TEST_CASE("OrderBook-Pegged") {
+    std::ostringstream            events;
+    MarketDataRecorder            r{{.ostream = events, .estream = events}};
+    OrderBook<MarketDataRecorder> orderBook{r};
+    orderBook.matchAddNewOrder(OrderID{1}, Side::Buy, Qty{100}, CentPrice{2990});
+    orderBook.matchAddNewOrder(OrderID{2}, Side::Sell, Qty{100}, CentPrice{3010});
+
+    CHECK(orderBook.matchAddPeggedOrder(OrderID{10}, Side::Buy, Qty{50}, PegType::Primary));
+    CHECK(orderBook.matchAddPeggedOrder(OrderID{11}, Side::Buy, Qty{50}, PegType::Midpoint));
+    CHECK_FALSE(orderBook.matchAddPeggedOrder(OrderID{11}, Side::Sell, Qty{50}, PegType::Midpoint)); // duplicate
+    CHECK_EQ(2, orderBook.countPeggedOrders(Side::Buy));
+    CHECK_EQ(Qty{100}, orderBook.topOfBook().bid.totalQty); // not displayed
+    CHECK_FALSE(r.orders.contains(10));
+
+    // Midpoint orders match each other at 3000.
+    orderBook.matchAddPeggedOrder(OrderID{12}, Side::Sell, Qty{20}, PegType::Midpoint);
+    REQUIRE_EQ(1, r.lastTrades.size());
+    CHECK_EQ(CentPrice{3000}, r.lastTrades[0].tradePrice);
+    CHECK_EQ(OrderID{11}, r.lastTrades[0].restingOrderFill.orderID);
+    CHECK_EQ(0, orderBook.countPeggedOrders(Side::Sell));
+
+    // the midpoint is the best price, then the level at 2990 before the Primary order at 2990.
+    orderBook.matchAddNewOrder(OrderID{13}, Side::Sell, Qty{100}, CentPrice{2990});
+    REQUIRE_EQ(2, r.lastTrades.size());
+    CHECK_EQ(Qty{30}, r.lastTrades[0].tradeQty);
+    CHECK_EQ(CentPrice{3000}, r.lastTrades[0].tradePrice);
+    CHECK_EQ(OrderID{1}, r.lastTrades[1].restingOrderFill.orderID);
+    CHECK_EQ(Qty{70}, r.lastTrades[1].tradeQty);
+    CHECK_EQ(1, orderBook.countPeggedOrders(Side::Buy));
+
+    // the Primary order follows the best bid, behind the level's orders.
+    orderBook.matchAddNewOrder(OrderID{14}, Side::Buy, Qty{10}, CentPrice{2995});
+    orderBook.matchAddNewOrder(OrderID{15}, Side::Sell, Qty{60}, CentPrice{2990});
+    REQUIRE_EQ(2, r.lastTrades.size());
+    CHECK_EQ(OrderID{14}, r.lastTrades[0].restingOrderFill.orderID);
+    CHECK_EQ(OrderID{10}, r.lastTrades[1].restingOrderFill.orderID);
+    CHECK_EQ(CentPrice{2995}, r.lastTrades[1].tradePrice);
+    CHECK(r.lastTrades[1].restingOrderFill.isFull);
+    CHECK_EQ(0, orderBook.countPeggedOrders(Side::Buy));
+
+    // fill or kill counts pegged orders.
+    orderBook.matchAddPeggedOrder(OrderID{16}, Side::Buy, Qty{100}, PegType::Primary);
+    CHECK_FALSE(orderBook.matchAddNewOrder(OrderID{17}, Side::Sell, Qty{131}, CentPrice{2990}, TimeInForce::FOK));
+    CHECK(orderBook.matchAddNewOrder(OrderID{17}, Side::Sell, Qty{130}, CentPrice{2990}, TimeInForce::FOK));
+    CHECK_EQ(0, orderBook.countOrders(Side::Buy));
+    CHECK_EQ(0, orderBook.countPeggedOrders(Side::Buy));
+
+    // no best bid: a Primary order rests without a price and doesn't match.
+    orderBook.matchAddPeggedOrder(OrderID{18}, Side::Buy, Qty{100}, PegType::Primary);
+    orderBook.matchAddNewOrder(OrderID{19}, Side::Sell, Qty{10}, CentPrice{1});
+    CHECK_EQ(1, orderBook.countPeggedOrders(Side::Buy));
+    CHECK_FALSE(orderBook.amendOrder(OrderID{18}, Qty{50}, CentPrice{2000}));
+    CHECK_NE(std::string::npos, events.str().find("Pegged"));
+    CHECK(orderBook.cancelOrder(OrderID{18}));
+    CHECK_EQ(0, orderBook.countPeggedOrders(Side::Buy));
+
+    orderBook.matchAddPeggedOrder(OrderID{20}, Side::Sell, Qty{10}, PegType::Midpoint);
+    CHECK_EQ(3, orderBook.cancelAll()); // orders 2, 19 and 20
+    CHECK_EQ(0, orderBook.countPeggedOrders(Side::Sell));
+    CHECK(r.consistent);
+}
+
+TEST_CASE("OrderBook-Session") {
+    std::ostringstream            events;
+    MarketDataRecorder            r{{.ostream = events, .estream = events}};
+    OrderBook<MarketDataRecorder> orderBook{r};
+    for (OrderID id = 1; id <= 6; ++id) orderBook.matchAddSessionOrder(id, Side::Buy, Qty{100}, CentPrice(3000 - int(id)), SessionID(id % 2 + 1));
+    orderBook.matchAddNewOrder(OrderID{7}, Side::Buy, Qty{100}, CentPrice{2990});
+    orderBook.matchAddSessionOrder(OrderID{8}, Side::Sell, Qty{100}, CentPrice{3010}, SessionID{1});
+    CHECK_FALSE(orderBook.matchAddSessionOrder(OrderID{8}, Side::Sell, Qty{100}, CentPrice{3010}, SessionID{2})); // duplicate
+    CHECK_FALSE(orderBook.matchAddSessionOrder(OrderID{11}, Side::Sell, Qty{100}, CentPrice{3010}, SessionID{1 << 16}));
+    CHECK_NE(std::string::npos, events.str().find("InvalidSession"));
+    CHECK_EQ(7, orderBook.countSessionOrders());
+
+    orderBook.matchAddNewOrder(OrderID{9}, Side::Sell, Qty{100}, CentPrice{2999}); // fills order 1 of session 2.
+    orderBook.cancelOrder(OrderID{3});                                             // session 2
+    orderBook.replaceOrder(OrderID{5}, OrderID{15}, Qty{50}, CentPrice{2980});     // session 2 follows the new orderID.
+    orderBook.matchAddSessionOrder(OrderID{10}, Side::Sell, Qty{100}, CentPrice{2990}, SessionID{2}, 0, SelfTrade::CancelResting,
+                                   TimeInForce::IOC); // fills order 2 of session 1 and doesn't rest.
+    CHECK_EQ(4, orderBook.countSessionOrders());
+
+    CHECK_EQ(0, orderBook.cancelSession(SessionID{3}));
+    CHECK_EQ(1, orderBook.cancelSession(SessionID{2}));
+    CHECK_FALSE(r.orders.contains(15));
+    CHECK_EQ(0, orderBook.cancelSession(SessionID{2}));
+    CHECK_EQ(3, orderBook.cancelSession(SessionID{1}));
+    CHECK_EQ(0, orderBook.countSessionOrders());
+    CHECK_EQ(0, orderBook.countOrders(Side::Sell));
+    REQUIRE_EQ(1, orderBook.countOrders(Side::Buy));
+    CHECK(r.orders.contains(7));
+
+    // slots are reused after a mass cancel.
+    orderBook.matchAddSessionOrder(OrderID{20}, Side::Buy, Qty{100}, CentPrice{2990}, SessionID{1});
+    orderBook.cancelAll();
+    orderBook.matchAddSessionOrder(OrderID{21}, Side::Buy, Qty{100}, CentPrice{2990}, SessionID{1});
+    CHECK_EQ(1, orderBook.cancelSession(SessionID{1}));
+    CHECK(r.consistent);
+}
+
+TEST_CASE("OrderBook-Risk") {
+    using Risk = PreTradeRisk<RiskCheck::All>;
+    std::ostringstream                  events;
+    MarketDataRecorder                  r{{.ostream = events, .estream = events}};
+    OrderBook<MarketDataRecorder, Risk> orderBook{r};
+    orderBook.risk().setLimits(RiskLimits{.maxQty = 1000, .maxNotional = 1'000'000, .priceBand = 100, .maxOpenOrders = 2, .maxPosition = 500});
+    auto lastError = [&] { return events.str().substr(events.str().rfind("Error: ")); };
+
+    // fat finger limits. Without trade nor BBO there's no price band.
+    CHECK(orderBook.matchAddNewOrder(OrderID{1}, Side::Buy, Qty{100}, CentPrice{3000}));
+    CHECK_FALSE(orderBook.matchAddNewOrder(OrderID{2}, Side::Buy, Qty{1001}, CentPrice{1}));
+    CHECK_NE(std::string::npos, lastError().find("QtyLimit, orderID: 2"));
+    CHECK_FALSE(orderBook.matchAddNewOrder(OrderID{2}, Side::Buy, Qty{400}, CentPrice{3000}));
+    CHECK_NE(std::string::npos, lastError().find("NotionalLimit"));
+    CHECK_FALSE(orderBook.addPostOnlyOrder(OrderID{2}, Side::Sell, Qty{100}, CentPrice{3101})); // the bid is the reference.
+    CHECK_NE(std::string::npos, lastError().find("PriceBand"));
+    CHECK(orderBook.addPostOnlyOrder(OrderID{2}, Side::Sell, Qty{100}, CentPrice{3100}));
+    CHECK_EQ(1, orderBook.countOrders(Side::Sell));
+
+    // open orders of an account.
+    CHECK(orderBook.matchAddOwnerOrder(OrderID{10}, Side::Buy, Qty{100}, CentPrice{2990}, OwnerID{7}));
+    CHECK(orderBook.matchAddOwnerOrder(OrderID{11}, Side::Buy, Qty{100}, CentPrice{2980}, OwnerID{7}));
+    CHECK_FALSE(orderBook.matchAddOwnerOrder(OrderID{12}, Side::Buy, Qty{100}, CentPrice{2980}, OwnerID{7}));
+    CHECK_NE(std::string::npos, lastError().find("OpenOrderLimit"));
+    CHECK(orderBook.matchAddNewOrder(OrderID{12}, Side::Buy, Qty{100}, CentPrice{2980})); // no account
+    CHECK_FALSE(orderBook.matchAddOwnerOrder(OrderID{13}, Side::Buy, Qty{100}, CentPrice{2980}, OwnerID{Risk::MaxOwnerID + 1}));
+    CHECK_NE(std::string::npos, lastError().find("UnknownAccount"));
+    CHECK_FALSE(orderBook.risk().setAccountLimits(OwnerID{Risk::MaxOwnerID + 1}, 10, 100));
+    orderBook.cancelOrder(OrderID{11});
+    CHECK_EQ(1, orderBook.risk().openOrders(OwnerID{7}));
+
+    // positions: fills of the aggressive and the resting orders.
+    CHECK(orderBook.matchAddOwnerOrder(OrderID{20}, Side::Sell, Qty{300}, CentPrice{2990}, OwnerID{8})); // fills 1 and 10, 100 rests.
+    CHECK_EQ(-200, orderBook.risk().position(OwnerID{8}));
+    CHECK_EQ(100, orderBook.risk().position(OwnerID{7}));
+    CHECK_EQ(0, orderBook.risk().openOrders(OwnerID{7}));
+    CHECK_EQ(1, orderBook.risk().openOrders(OwnerID{8}));
+    CHECK_EQ(100, orderBook.risk().openQty(OwnerID{8}, Side::Sell));
+    CHECK_FALSE(orderBook.matchAddOwnerOrder(OrderID{21}, Side::Sell, Qty{201}, CentPrice{2990}, OwnerID{8})); // -200 - 100 - 201
+    CHECK_NE(std::string::npos, lastError().find("PositionLimit"));
+    CHECK_FALSE(orderBook.matchAddOwnerOrder(OrderID{21}, Side::Sell, Qty{100}, CentPrice{2889}, OwnerID{8})); // last trade 2990
+    CHECK_NE(std::string::npos, lastError().find("PriceBand"));
+
+    // an account limit; an order that reduces the position passes. The self trade cancels the resting order of owner 8.
+    CHECK(orderBook.risk().setAccountLimits(OwnerID{8}, 10, 100));
+    CHECK_FALSE(orderBook.matchAddOwnerOrder(OrderID{21}, Side::Sell, Qty{1}, CentPrice{2990}, OwnerID{8}));
+    CHECK(orderBook.matchAddOwnerOrder(OrderID{21}, Side::Buy, Qty{150}, CentPrice{2990}, OwnerID{8}));
+    CHECK_EQ(-200, orderBook.risk().position(OwnerID{8}));
+    CHECK_EQ(1, orderBook.risk().openOrders(OwnerID{8}));
+    CHECK_EQ(0, orderBook.risk().openQty(OwnerID{8}, Side::Sell));
+    CHECK_EQ(150, orderBook.risk().openQty(OwnerID{8}, Side::Buy));
+    CHECK_FALSE(orderBook.matchAddOwnerOrder(OrderID{22}, Side::Buy, Qty{251}, CentPrice{2980}, OwnerID{8})); // -200 + 150 + 251
+    CHECK_NE(std::string::npos, lastError().find("PositionLimit"));
+
+    // amends, partial cancels and resting fills change the open qty.
+    CHECK(orderBook.amendOrder(OrderID{21}, Qty{200}, CentPrice{2990}));
+    CHECK(orderBook.partialCancelOrder(OrderID{21}, Qty{20}));
+    CHECK_EQ(180, orderBook.risk().openQty(OwnerID{8}, Side::Buy));
+    CHECK(orderBook.matchAddNewOrder(OrderID{23}, Side::Sell, Qty{30}, CentPrice{2990}));
+    CHECK_EQ(-170, orderBook.risk().position(OwnerID{8}));
+    CHECK_EQ(150, orderBook.risk().openQty(OwnerID{8}, Side::Buy));
+    orderBook.cancelAll();
+    CHECK_EQ(0, orderBook.risk().openOrders(OwnerID{8}));
+    CHECK_EQ(0, orderBook.risk().openQty(OwnerID{8}, Side::Buy));
+
+    // every path into the book is checked; the last trade, 2990, is the reference.
+    REQUIRE(orderBook.matchAddOwnerOrder(OrderID{30}, Side::Buy, Qty{10}, CentPrice{2990}, OwnerID{7}));
+    REQUIRE(orderBook.matchAddNewOrder(OrderID{40}, Side::Sell, Qty{100}, CentPrice{3000}));
+    SUBCASE("Amend") {
+        CHECK_FALSE(orderBook.amendOrder(OrderID{30}, Qty{1001}, CentPrice{2990}));
+        CHECK_NE(std::string::npos, lastError().find("QtyLimit, orderID: 30"));
+        CHECK_FALSE(orderBook.amendOrder(OrderID{30}, Qty{10}, CentPrice{2800}));
+        CHECK_NE(std::string::npos, lastError().find("PriceBand"));
+        CHECK(orderBook.matchAddOwnerOrder(OrderID{31}, Side::Buy, Qty{10}, CentPrice{2980}, OwnerID{7}));
+        CHECK(orderBook.amendOrder(OrderID{30}, Qty{20}, CentPrice{2990})); // the same open order, at the open-order limit.
+        CHECK_EQ(30, orderBook.risk().openQty(OwnerID{7}, Side::Buy));
+    }
+    SUBCASE("Replace") {
+        CHECK_FALSE(orderBook.replaceOrder(OrderID{30}, OrderID{32}, Qty{1001}, CentPrice{2990}));
+        CHECK_NE(std::string::npos, lastError().find("QtyLimit, orderID: 30"));
+        CHECK_EQ(1, orderBook.countOrders(Side::Buy));
+    }
+    SUBCASE("Market") {
+        CHECK_FALSE(orderBook.matchMarketOrder(OrderID{41}, Side::Buy, Qty{1001}));
+        CHECK_NE(std::string::npos, lastError().find("QtyLimit"));
+        CHECK_FALSE(orderBook.matchMarketOrder(OrderID{41}, Side::Buy, Qty{330}, CentPrice{100})); // 330 * 3100 at the band limit
+        CHECK_NE(std::string::npos, lastError().find("NotionalLimit"));
+        CHECK(orderBook.matchMarketOrder(OrderID{41}, Side::Buy, Qty{330})); // 330 * 3000 at the touch
+        CHECK_EQ(0, orderBook.countOrders(Side::Sell));
+    }
+    SUBCASE("Stop") { // released right away: the last trade has reached the stop price.
+        CHECK(orderBook.addStopOrder(OrderID{50}, Side::Buy, Qty{1001}, CentPrice{2990}));
+        CHECK_NE(std::string::npos, lastError().find("QtyLimit, orderID: 50"));
+        CHECK(orderBook.addStopLimitOrder(OrderID{51}, Side::Buy, Qty{100}, CentPrice{2990}, CentPrice{3100}));
+        CHECK_NE(std::string::npos, lastError().find("PriceBand, orderID: 51"));
+        CHECK_EQ(1, orderBook.countOrders(Side::Sell));
+        CHECK_EQ(1, orderBook.countOrders(Side::Buy));
+    }
+    SUBCASE("Pegged") {
+        CHECK_FALSE(orderBook.matchAddPeggedOrder(OrderID{60}, Side::Buy, Qty{1001}, PegType::Primary));
+        CHECK_NE(std::string::npos, lastError().find("QtyLimit, orderID: 60"));
+        CHECK_EQ(0, orderBook.countPeggedOrders(Side::Buy));
+    }
+    CHECK(r.consistent);
+}
+
+TEST_CASE("TimingWheel") {
+    std::mt19937_64                   rng{7};
+    TimingWheel<uint64_t>             wheel{100};
+    std::multimap<uint64_t, uint64_t> expected; // fire time -> value
+    std::map<uint64_t, uint32_t>      timerByValue;
+    uint64_t                          now = 100;
+    for (uint64_t value = 0; value < 20000; ++value) {
+        uint64_t range = uint64_t(1) << (rng() % 40);
+        uint64_t time  = now - 50 + rng() % range; // some are already due.
+        timerByValue[value] = wheel.add(time, value);
+        expected.emplace(std::max(time, now), value); // a timer that's already due fires first
+        if (rng() % 4 == 0) { // cancel a random live timer
+            auto it = timerByValue.lower_bound(rng() % (value + 1));
+            if (it == timerByValue.end()) continue;
+            wheel.cancel(it->second);
+            for (auto e = expected.begin(); e != expected.end(); ++e) {
+                if (e->second == it->first) {
+                    expected.erase(e);
+                    break;
+                }
+            }
+            timerByValue.erase(it);
+        }
+        if (rng() % 16 == 0) {
+            now += rng() % (uint64_t(1) << (rng() % 36));
+            uint64_t lastTime = 0;
+            size_t   nFired   = wheel.advance(now, [&](uint32_t, uint64_t firedValue) {
+                auto e = expected.begin();
+                REQUIRE(e != expected.end());
+                REQUIRE_LE(e->first, now);
+                CHECK_LE(lastTime, e->first);
+                lastTime = e->first;
+                auto same = std::find_if(e, expected.upper_bound(e->first), [&](auto &x) { return x.second == firedValue; });
+                REQUIRE(same != expected.upper_bound(e->first)); // fired in time order
+                expected.erase(same);
+                timerByValue.erase(firedValue);
+            });
+            CHECK_EQ(wheel.now(), now);
+            CHECK((expected.empty() || expected.begin()->first > now));
+            CHECK_EQ(expected.size(), wheel.size());
+            CHECK_LE(nFired, 20000);
+        }
+    }
+    size_t nLeft = wheel.size();
+    CHECK_EQ(nLeft, wheel.advance(~uint64_t(0), [](uint32_t, uint64_t) {}));
+    CHECK_EQ(0, wheel.size());
+}
+
+TEST_CASE("LatencyHistogram") {
+    // buckets are contiguous and monotonic across power-of-2 boundaries.
+    for (uint64_t v : {31ull, 32ull, 63ull, 64ull, 1000ull, 1ull << 40, ~0ull}) {
+        size_t index = LatencyHistogram::bucketIndex(v);
+        REQUIRE_LT(index, LatencyHistogram::NumBuckets);
+        CHECK_LE(v, LatencyHistogram::bucketUpperValue(index));
+        if (index) CHECK_LT(LatencyHistogram::bucketUpperValue(index - 1), v);
+    }
+
+    LatencyHistogram histogram;
+    CHECK_EQ(0, histogram.percentile(0.5));
+    for (uint64_t v = 1; v <= 100000; ++v) histogram.record(v);
+    CHECK_EQ(100000, histogram.count());
+    CHECK_EQ(100000, histogram.max());
+    CHECK_EQ(50000.5, histogram.mean());
+    for (double p : {0.5, 0.9, 0.99, 0.999}) {
+        double expected = p * 100000;
+        CHECK_GE(histogram.percentile(p), expected);
+        CHECK_LE(histogram.percentile(p), expected * (1 + 1.0 / LatencyHistogram::SubBucketCount));
+    }
+    CHECK_EQ(100000, histogram.percentile(1));
+
+    LatencyHistogram other;
+    other.record(1u << 20);
+    histogram.merge(other);
+    CHECK_EQ(100001, histogram.count());
+    CHECK_EQ(1u << 20, histogram.max());
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <array>
+#include <string>
+#include <stdint.h>
+
+#include "OrderBook.h"
+
+/// RollingHash is a streaming 64-bit hash using the xxHash64 round & avalanche functions over 64-bit words.
+class RollingHash {
+    static constexpr uint64_t Prime1 = 0x9E3779B185EBCA87ULL, Prime2 = 0xC2B2AE3D27D4EB4FULL, Prime3 = 0x165667B19E3779F9ULL;
+    uint64_t                  _state = Prime3;
+
+    static constexpr uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+public:
+    void add(uint64_t word) { _state = rotl(_state ^ rotl(word * Prime2, 31) * Prime1, 27) * Prime1 + Prime3; }
+
+    uint64_t digest() const {
+        uint64_t h = _state;
+        h ^= h >> 33;
+        h *= Prime2;
+        h ^= h >> 29;
+        h *= Prime3;
+        h ^= h >> 32;
+        return h;
+    }
+};
+
+/// EventDigestReporter hashes all events in order and counts them by type instead of printing them.
+struct EventDigestReporter {
+    RollingHash             hash;
+    std::array<uint64_t, 8> eventCounts{}; // indexed by MsgType
+    uint64_t                errorCount{};
+
+    void onTrade(const TradeMsg &msg) {
+        hash.add(uint64_t(MsgType::TradeEvent));
+        hash.add((uint64_t(uint32_t(msg.tradeQty)) << 32) | uint32_t(msg.tradePrice));
+        ++eventCounts[int(MsgType::TradeEvent)];
+        addFill(msg.aggressiveOrderFill);
+        addFill(msg.restingOrderFill);
+    }
+    void onError(OrderID orderID, MsgType msgType, ErrCode errCode, const std::string &) {
+        hash.add(0xFFFF);
+        hash.add(orderID);
+        hash.add((uint64_t(msgType) << 8) | uint64_t(errCode));
+        ++errorCount;
+    }
+
+private:
+    void addFill(const TradeMsg::Fill &fill) {
+        MsgType msgType = fill.isFull ? MsgType::OrderFullyFilled : MsgType::OrderPartiallyFilled;
+        hash.add(uint64_t(msgType));
+        hash.add(fill.orderID);
+        if (!fill.isFull) hash.add(uint64_t(uint32_t(fill.leaveQty)));
+        ++eventCounts[int(msgType)];
+    }
+};
+static_assert(BookEventReporter<EventDigestReporter>, "EventDigestReporter Impl BookEventReporter");
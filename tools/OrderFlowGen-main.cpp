@@ -0,0 +1,87 @@
+#include <iostream>
+#include <fstream>
+
+#include "OrderBook.h"
+#include "RequestParser.h"
+#include "Journal.h"
+#include "OrderFlowGenerator.h"
+
+/// OrderFlowGen writes a synthetic, seeded order flow as CSV (the input format of SimpleMatchingEngineMain)
+/// or as a binary journal (with bookID per request for multiple symbols).
+
+int main(int argc, char *argv[]) {
+    OrderFlowConfig config;
+    uint64_t        nRequests = 1000000;
+    std::string     outputPath = "-";
+    bool            binary     = false;
+
+    auto usage = [&] {
+        std::cerr << "Usage: " << argv[0] << " [options]\n"
+                  << "  -n nRequests          default: " << nRequests << "\n"
+                  << "  -s seed               default: " << config.seed << "\n"
+                  << "  -o outputFile         default: - (stdout)\n"
+                  << "  --binary              write a binary journal instead of CSV. Required for more than 1 symbol.\n"
+                  << "  --symbols N           default: " << config.nSymbols << "\n"
+                  << "  --mix add:cancel:replace  default: " << config.addWeight << ":" << config.cancelWeight << ":" << config.replaceWeight << "\n"
+                  << "  --price startCents    default: " << config.startPrice << "\n"
+                  << "  --walk prob:ticks     mid price random walk per request. default: " << config.walkProb << ":" << config.walkTicks << "\n"
+                  << "  --depth decay:max     passive offset from mid is 1 + geometric(decay) ticks, up to max. default: " << config.depthDecay
+                  << ":" << config.maxDepthTicks << "\n"
+                  << "  --aggressive ratio:maxSweepTicks  default: " << config.aggressiveRatio << ":" << config.maxSweepTicks << "\n"
+                  << "  --qty mean:sigma:lot  lognormal order size. default: " << config.meanQty << ":" << config.qtySigma << ":" << config.lotSize
+                  << std::endl;
+        return 1;
+    };
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc && arg != "--binary") return usage();
+        if (arg == "-n") {
+            nRequests = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "-s") {
+            config.seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "-o") {
+            outputPath = argv[++i];
+        } else if (arg == "--binary") {
+            binary = true;
+        } else if (arg == "--symbols") {
+            config.nSymbols = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--price") {
+            config.startPrice = std::strtol(argv[++i], nullptr, 10);
+        } else {
+            auto values = StrUtil::split_str(argv[++i], ':');
+            auto number = [&](size_t index, auto &value) {
+                if (index < values.size()) value = decltype(value + 0)(std::strtod(values[index].c_str(), nullptr));
+            };
+            if (arg == "--mix") {
+                number(0, config.addWeight), number(1, config.cancelWeight), number(2, config.replaceWeight);
+            } else if (arg == "--walk") {
+                number(0, config.walkProb), number(1, config.walkTicks);
+            } else if (arg == "--depth") {
+                number(0, config.depthDecay), number(1, config.maxDepthTicks);
+            } else if (arg == "--aggressive") {
+                number(0, config.aggressiveRatio), number(1, config.maxSweepTicks);
+            } else if (arg == "--qty") {
+                number(0, config.meanQty), number(1, config.qtySigma), number(2, config.lotSize);
+            } else {
+                return usage();
+            }
+        }
+    }
+    EXPECT_OR_ERR(binary || config.nSymbols <= 1, return usage(), "ERROR: CSV has no symbol field; use --binary for multiple symbols.");
+    EXPECT_OR_ERR(!binary || outputPath != "-", return usage(), "ERROR: --binary needs an output file.");
+
+    OrderFlowGenerator gen(config);
+    if (binary) {
+        JournalWriter journal;
+        EXPECT_OR_ERR(journal.open(outputPath, JournalConfig{.groupCommitRecords = 4096}), return 1, "ERROR: failed to open " << outputPath);
+        for (uint64_t i = 0; i < nRequests; ++i) journal.append(gen.next());
+    } else {
+        std::ofstream file;
+        if (outputPath != "-") file.open(outputPath);
+        std::ostream &os = outputPath == "-" ? std::cout : file;
+        EXPECT_OR_ERR(os, return 1, "ERROR: failed to open " << outputPath);
+        for (uint64_t i = 0; i < nRequests; ++i) formatRequestCSV(os, gen.next());
+    }
+    std::cerr << "Generated " << nRequests << " requests, live orders: " << gen.countLiveOrders() << std::endl;
+    return 0;
+}
@@ -0,0 +1,164 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <random>
+#include <cmath>
+#include <stdint.h>
+
+#include "OrderBook.h"
+
+/// OrderFlowConfig configures a synthetic order flow.
+struct OrderFlowConfig {
+    uint64_t  seed         = 1;
+    uint32_t  nSymbols     = 1;
+    OrderID   firstOrderID = 1;
+    // request mix, normalized. Cancel & replace pick a random live order; they turn into adds if there's none.
+    double    addWeight = 60, cancelWeight = 30, replaceWeight = 10;
+    // price random walk of the mid price: each request moves the mid of its symbol by +/- walkTicks with walkProb.
+    CentPrice startPrice = 10000;
+    CentPrice walkTicks  = 1;
+    double    walkProb   = 0.05;
+    // level depth: passive orders are placed geometric(depthDecay) ticks behind the touch, up to maxDepthTicks.
+    double    depthDecay    = 0.2;
+    CentPrice maxDepthTicks = 100;
+    // aggressiveness: ratio of adds that cross the mid by uniform [0, maxSweepTicks] ticks.
+    double    aggressiveRatio = 0.1;
+    CentPrice maxSweepTicks   = 5;
+    // order size: lognormal with the mean qty and sigma, rounded up to lots.
+    double    meanQty  = 100;
+    double    qtySigma = 1.0;
+    Qty       lotSize  = 1;
+};
+
+/// OrderFlowGenerator generates reproducible requests: only raw 64-bit mt19937_64 outputs are used (not std distributions),
+/// so a seed gives the same stream on any platform. It runs a shadow OrderBook per symbol to track live orders,
+/// so that cancels and replaces reference resting orders like production traffic does.
+class OrderFlowGenerator {
+    struct ShadowReporter {
+        OrderFlowGenerator *gen = nullptr;
+        void                onTrade(const TradeMsg &msg) {
+            if (msg.restingOrderFill.isFull) gen->removeLive(msg.restingOrderFill.orderID);
+            if (msg.aggressiveOrderFill.isFull) gen->_aggressiveFilled = true;
+        }
+        void onError(OrderID, MsgType, ErrCode, const std::string &) {}
+    };
+    struct LiveOrder {
+        size_t index; // in liveOrders
+        Side   side;
+    };
+    struct SymbolState {
+        CentPrice                              mid{};
+        std::vector<OrderID>                   liveOrders;
+        std::unordered_map<OrderID, LiveOrder> liveOrderMap;
+    };
+
+    OrderFlowConfig                       _config;
+    std::mt19937_64                       _rng;
+    ShadowReporter                        _reporter{this};
+    std::deque<OrderBook<ShadowReporter>> _books; // shadow books by symbol
+    std::vector<SymbolState>              _symbols;
+    OrderID                               _nextOrderID;
+    uint32_t                              _curSymbol{};
+    bool                                  _aggressiveFilled = false;
+    double                                _addProb, _addOrCancelProb; // cumulative mix probabilities
+
+public:
+    explicit OrderFlowGenerator(const OrderFlowConfig &config)
+        : _config(config), _rng(config.seed), _symbols(std::max<uint32_t>(config.nSymbols, 1)), _nextOrderID(config.firstOrderID) {
+        for (SymbolState &sym : _symbols) {
+            sym.mid = _config.startPrice;
+            _books.emplace_back(_reporter);
+        }
+        double total     = _config.addWeight + _config.cancelWeight + _config.replaceWeight;
+        _addProb         = _config.addWeight / total;
+        _addOrCancelProb = (_config.addWeight + _config.cancelWeight) / total;
+    }
+
+    /// @return the next request. It's been applied to the shadow book.
+    OrderRequest next() {
+        _curSymbol       = uint32_t(_rng() % _symbols.size());
+        SymbolState &sym = _symbols[_curSymbol];
+        if (uniform() < _config.walkProb) sym.mid = std::max<CentPrice>(sym.mid + (_rng() & 1 ? _config.walkTicks : -_config.walkTicks), 1);
+
+        OrderRequest req{.bookID = _curSymbol};
+        double       action = uniform();
+        if (action < _addProb || sym.liveOrders.empty()) {
+            req.msgType = MsgType::AddOrderRequest;
+            req.orderID = _nextOrderID++;
+            req.side    = _rng() & 1 ? Side::Sell : Side::Buy;
+            req.qty     = sampleQty();
+            req.price   = uniform() < _config.aggressiveRatio ? aggressivePrice(sym, req.side) : passivePrice(sym, req.side);
+        } else {
+            req.orderID = sym.liveOrders[_rng() % sym.liveOrders.size()];
+            req.side    = sym.liveOrderMap[req.orderID].side;
+            if (action < _addOrCancelProb) {
+                req.msgType = MsgType::CancelOrderRequest;
+            } else {
+                req.msgType    = MsgType::ReplaceOrderRequest;
+                req.newOrderID = _nextOrderID++;
+                req.qty        = sampleQty();
+                req.price      = passivePrice(sym, req.side);
+            }
+        }
+        apply(req);
+        return req;
+    }
+
+    size_t countLiveOrders() const {
+        size_t n = 0;
+        for (const SymbolState &sym : _symbols) n += sym.liveOrders.size();
+        return n;
+    }
+
+private:
+    double uniform() { return double(_rng() >> 11) * 0x1.0p-53; }
+
+    /// geometric distribution: number of failures before the first success with probability p.
+    CentPrice geometric(double p) { return p >= 1 ? 0 : CentPrice(std::floor(std::log(1 - uniform()) / std::log(1 - p))); }
+
+    Qty sampleQty() {
+        // Box-Muller normal -> lognormal with the configured mean: exp(mu + sigma * z), mu = log(mean) - sigma^2/2.
+        double z   = std::sqrt(-2 * std::log(1 - uniform())) * std::cos(2 * 3.141592653589793 * uniform());
+        double qty = std::exp(std::log(_config.meanQty) - _config.qtySigma * _config.qtySigma / 2 + _config.qtySigma * z);
+        Qty    lot = std::max<Qty>(_config.lotSize, 1);
+        return std::max<Qty>(lot, Qty(std::ceil(std::min(qty, 1e9) / lot)) * lot);
+    }
+
+    CentPrice passivePrice(const SymbolState &sym, Side side) {
+        CentPrice depth = 1 + std::min(geometric(_config.depthDecay), _config.maxDepthTicks);
+        return side == Side::Buy ? std::max<CentPrice>(sym.mid - depth, 1) : sym.mid + depth;
+    }
+    CentPrice aggressivePrice(const SymbolState &sym, Side side) {
+        CentPrice sweep = CentPrice(_rng() % (uint64_t(std::max<CentPrice>(_config.maxSweepTicks, 0)) + 1));
+        return side == Side::Buy ? sym.mid + sweep : std::max<CentPrice>(sym.mid - sweep, 1);
+    }
+
+    void apply(const OrderRequest &req) {
+        OrderID restingID = req.msgType == MsgType::AddOrderRequest ? req.orderID : 0;
+        if (req.msgType != MsgType::AddOrderRequest) removeLive(req.orderID);
+        if (req.msgType == MsgType::ReplaceOrderRequest) restingID = req.newOrderID;
+        _aggressiveFilled = false;
+        _books[req.bookID].handleRequest(req);
+        if (restingID && !_aggressiveFilled) addLive(restingID, req.side);
+    }
+
+    void addLive(OrderID orderID, Side side) {
+        SymbolState &sym = _symbols[_curSymbol];
+        sym.liveOrderMap.try_emplace(orderID, LiveOrder{.index = sym.liveOrders.size(), .side = side});
+        sym.liveOrders.push_back(orderID);
+    }
+    void removeLive(OrderID orderID) {
+        SymbolState &sym = _symbols[_curSymbol];
+        if (auto it = sym.liveOrderMap.find(orderID); it != sym.liveOrderMap.end()) {
+            size_t  index = it->second.index;
+            OrderID moved = sym.liveOrders.back(); // swap with the last one
+            sym.liveOrderMap.erase(it);
+            sym.liveOrders.pop_back();
+            if (moved != orderID) {
+                sym.liveOrders[index]         = moved;
+                sym.liveOrderMap[moved].index = index;
+            }
+        }
+    }
+};
@@ -0,0 +1,138 @@
+#include <iostream>
+#include <fstream>
+#include <deque>
+#include <chrono>
+#include <cstring>
+
+#include "OrderBook.h"
+#include "RequestParser.h"
+#include "Journal.h"
+#include "EventDigest.h"
+
+/// ReplayDigest runs a request file (CSV or binary journal) through order books and prints a digest of all emitted events
+/// and per-message counts. Use checkpoints to find the first divergent request between two builds.
+
+struct ReplayOptions {
+    std::string inputPath       = "-"; // CSV file, journal file or - for stdin (CSV).
+    uint64_t    checkpointEvery = 0;   // print a checkpoint digest every N requests.
+    std::string comparePath;           // checkpoint output of a baseline run.
+};
+
+class Replayer {
+    EventDigestReporter                         _reporter;
+    std::deque<OrderBook<EventDigestReporter>>  _books; // indexed by bookID. deque doesn't move books.
+    std::array<uint64_t, 8>                     _requestCounts{};
+    uint64_t                                    _nRequests{}, _nInvalidRequests{}, _lastSeq{};
+    const ReplayOptions                        &_options;
+    std::ifstream                               _compareFile;
+    uint64_t                                    _lastMatchedSeq{};
+
+public:
+    bool diverged = false;
+
+    explicit Replayer(const ReplayOptions &options) : _options(options) {
+        if (!options.comparePath.empty()) _compareFile.open(options.comparePath);
+    }
+
+    /// @param seq  line number for CSV, record seq for journal.
+    void onRequest(uint64_t seq, const OrderRequest *req) {
+        if (diverged) return;
+        if (req) {
+            while (_books.size() <= req->bookID) _books.emplace_back(_reporter);
+            ++_requestCounts[int(req->msgType) % _requestCounts.size()];
+            _books[req->bookID].handleRequest(*req);
+        } else {
+            ++_nInvalidRequests;
+            _reporter.hash.add(0xFFFFFFFF);
+            _reporter.hash.add(seq);
+        }
+        ++_nRequests;
+        _lastSeq = seq;
+        if (_options.checkpointEvery && _nRequests % _options.checkpointEvery == 0) checkpoint();
+    }
+
+    /// print "checkpoint <seq> <digest>" and compare with baseline.
+    void checkpoint() {
+        uint64_t digest = _reporter.hash.digest();
+        std::cout << "checkpoint " << _lastSeq << " " << std::hex << digest << std::dec << std::endl;
+        if (!_compareFile.is_open()) return;
+        std::string tag;
+        uint64_t    expectedSeq = 0, expectedDigest = 0;
+        if (!(_compareFile >> tag >> expectedSeq >> std::hex >> expectedDigest >> std::dec) || tag != "checkpoint") {
+            std::cerr << "ERROR: no baseline checkpoint for seq " << _lastSeq << std::endl;
+            diverged = true;
+        } else if (expectedSeq != _lastSeq || expectedDigest != digest) {
+            std::cerr << "DIVERGED between seq " << _lastMatchedSeq << " (exclusive) and " << _lastSeq << ": expected checkpoint " << expectedSeq
+                      << " " << std::hex << expectedDigest << std::dec << std::endl;
+            diverged = true;
+        } else {
+            _lastMatchedSeq = _lastSeq;
+        }
+    }
+
+    uint64_t nRequests() const { return _nRequests; }
+
+    void printSummary(std::ostream &os, double seconds) const {
+        static const char *requestNames[8] = {
+                "AddOrderRequest", "CancelOrderRequest", "", "", "", "PartialCancelRequest", "ReplaceOrderRequest", "AmendOrderRequest"};
+        static const char *eventNames[8] = {"", "", "TradeEvent", "OrderFullyFilled", "OrderPartiallyFilled", "", "", ""};
+        os << "requests: " << _nRequests << "\n";
+        for (size_t i = 0; i < _requestCounts.size(); ++i)
+            if (_requestCounts[i]) os << "  " << requestNames[i] << ": " << _requestCounts[i] << "\n";
+        if (_nInvalidRequests) os << "  InvalidRequest: " << _nInvalidRequests << "\n";
+        os << "events:\n";
+        for (size_t i = 0; i < _reporter.eventCounts.size(); ++i)
+            if (_reporter.eventCounts[i]) os << "  " << eventNames[i] << ": " << _reporter.eventCounts[i] << "\n";
+        os << "  Error: " << _reporter.errorCount << "\n";
+        os << "books: " << _books.size() << "\n";
+        os << "digest: " << std::hex << _reporter.hash.digest() << std::dec << "\n";
+        os << "seconds: " << seconds << ", requests/sec: " << uint64_t(seconds > 0 ? _nRequests / seconds : 0) << std::endl;
+    }
+};
+
+int main(int argc, char *argv[]) {
+    ReplayOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-c" && i + 1 < argc) {
+            options.checkpointEvery = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--compare" && i + 1 < argc) {
+            options.comparePath = argv[++i];
+        } else if (arg[0] != '-' || arg == "-") {
+            options.inputPath = arg;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [-c checkpointEveryN] [--compare baselineOutput] [inputFile|-]\n"
+                      << "  inputFile is a CSV request file or a binary journal. Reads CSV from stdin by default." << std::endl;
+            return 1;
+        }
+    }
+
+    bool isJournal = false;
+    if (options.inputPath != "-") {
+        std::ifstream     file(options.inputPath, std::ios::binary);
+        JournalFileHeader header, expected;
+        EXPECT_OR_ERR(file, return 1, "ERROR: failed to open " << options.inputPath);
+        isJournal = file.read(reinterpret_cast<char *>(&header), sizeof(header)) &&
+                    std::memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0;
+    }
+
+    Replayer replayer(options);
+    auto     start = std::chrono::steady_clock::now();
+    if (isJournal) {
+        JournalScanResult res = scanJournal(options.inputPath, [&](const JournalRecord &rec) { replayer.onRequest(rec.seq, &rec.request); });
+        EXPECT_OR_ERR(res.ok, return 1, "ERROR: invalid journal " << options.inputPath);
+    } else {
+        std::ifstream file;
+        if (options.inputPath != "-") file.open(options.inputPath);
+        std::istream &input = options.inputPath == "-" ? std::cin : file;
+        StrUtil::read_each_str(input, '\n', [&](int iLine, std::string &line) {
+            OrderRequest req;
+            replayer.onRequest(uint64_t(iLine) + 1, parseRequestLine(iLine, line, req) ? &req : nullptr);
+            return !replayer.diverged;
+        });
+    }
+    if (!replayer.diverged && options.checkpointEvery && replayer.nRequests() % options.checkpointEvery) replayer.checkpoint(); // last one
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    replayer.printSummary(std::cout, seconds);
+    return replayer.diverged ? 2 : 0;
+}